@@ -1,59 +1,38 @@
+#include "library_core.h"
+
 #include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <algorithm>
-#include <cctype>
-#include <ctime>
-#include <limits>
 #include <iomanip>
+#include <queue>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-// ===== Helpers =====
+// ===== Console helpers =====
 void clearScreen() {
 #ifdef _WIN32
     system("cls");
 #else
-    system("clear");
+    // ANSI clear + home; avoids forking a shell for every screen
+    cout << "\033[2J\033[H" << flush;
 #endif
 }
 
-tm parseDate(const string& dateStr) {
-    tm date = {};
-    istringstream ss(dateStr);
-    ss >> get_time(&date, "%Y-%m-%d");
-    return date;
-}
-
-// Get current date as string "YYYY-MM-DD"
-string currentDate() {
-    time_t now = time(nullptr);
-    tm* ltm = localtime(&now);
-    char buffer[11];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d", ltm);
-    return string(buffer);
-}
-
-// Calculate days between two dates (date2 - date1)
-int daysBetween(const string& date1, const string& date2) {
-    tm d1 = parseDate(date1);
-    tm d2 = parseDate(date2);
-    time_t time1 = mktime(&d1);
-    time_t time2 = mktime(&d2);
-    double seconds = difftime(time2, time1);
-    return static_cast<int>(seconds / (60 * 60 * 24));
-}
-
 void pauseScreen() {
     cout << "\nPress Enter to continue...";
     // consume leftover newline then wait for Enter
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
-string toLowerCase(string str) {
-    transform(str.begin(), str.end(), str.begin(), ::tolower);
-    return str;
+string getOptionalLine(const string &prompt) {
+    cout << prompt;
+    string input;
+    getline(cin, input);
+    return input;
 }
 
 string getNonEmptyLine(const string &prompt) {
@@ -94,6 +73,59 @@ void printCenteredLine(const string &text, int width = 48) {
     cout << string(left, ' ') << text << string(right, ' ') << "\n";
 }
 
+// Append text left-aligned in a column of the given width (like setw, never truncates)
+void appendCell(string &out, string_view text, size_t width) {
+    out.append(text.data(), text.size());
+    if (text.size() < width) out.append(width - text.size(), ' ');
+}
+
+void appendCell(string &out, long long value, size_t width) {
+    char digits[24];
+    auto res = to_chars(digits, digits + sizeof(digits), value);
+    appendCell(out, string_view(digits, res.ptr - digits), width);
+}
+
+// Shows rowCount rows a page at a time. Each page is formatted by renderRow
+// into one pre-sized buffer and written with a single flush; between pages
+// the user can move forward/back or stop.
+void showPaged(const string &header, size_t rowCount, size_t rowWidth, size_t pageSize,
+               const function<void(string &, size_t)> &renderRow) {
+    if (pageSize == 0) pageSize = rowCount ? rowCount : 1;
+    size_t pages = max<size_t>((rowCount + pageSize - 1) / pageSize, 1);
+    size_t page = 0;
+    string buffer;
+    while (true) {
+        size_t first = page * pageSize, last = min(rowCount, first + pageSize);
+        buffer.clear();
+        buffer.reserve(header.size() + (last - first) * (rowWidth + 1) + 96);
+        buffer += header;
+        for (size_t row = first; row < last; ++row) {
+            renderRow(buffer, row);
+            buffer += '\n';
+        }
+        if (pages > 1) {
+            buffer += "\nPage " + to_string(page + 1) + "/" + to_string(pages) + " (rows " + to_string(first + 1) +
+                      "-" + to_string(last) + " of " + to_string(rowCount) + ")  [N]ext [P]rev [Q]uit: ";
+        }
+        cout.write(buffer.data(), (streamsize)buffer.size());
+        cout.flush();
+        if (pages == 1) return;
+
+        string input;
+        if (!getline(cin, input)) return;
+        char c = input.empty() ? 'n' : (char)tolower((unsigned char)input[0]);
+        if (c == 'q') return;
+        if (c == 'p') {
+            if (page > 0) --page;
+        } else if (page + 1 < pages) {
+            ++page;
+        } else {
+            return;
+        }
+        clearScreen();
+    }
+}
+
 void printBanner() {
     clearScreen();
     cout << string(48, '=') << "\n";
@@ -134,107 +166,15 @@ void displayMenuDecorated(const string &title, const vector<string> &options) {
     cout << "\n" << string(60, '-') << "\n";
 }
 
-// ===== Data structures =====
-struct Member {
-    string name;
-    string password;
-    string role;
-};
-
-struct Book {
-    int id;
-    string title;
-    string author;
-    int totalCopies;
-    int availableCopies;
-};
-
-struct Transaction {
-    int bookId;
-    string memberName;
-    string issueDate;
-    string returnDate;
-};
-
-// ===== Library class =====
-class Library {
+// ===== Console front end =====
+// The interactive menus. Everything goes through Library's public API; this
+// class only prompts, formats and pages.
+class LibraryConsole {
 private:
-    vector<Member> members;
-    vector<Book> books;
-    vector<Transaction> transactions;
-
-    string membersFile = "members.txt";
-    string booksFile = "books.txt";
-    string transactionsFile = "transactions.txt";
-
-public:
-    Library() {
-        loadMembers();
-        loadBooks();
-        loadTransactions();
-    }
-
-    // ---- File I/O ----
-    void loadMembers() {
-        members.clear();
-        ifstream file(membersFile);
-        if (!file) return;
-        Member m;
-        while (getline(file, m.name) && getline(file, m.password) && getline(file, m.role)) {
-            members.push_back(m);
-        }
-    }
-
-    void saveMembers() {
-        ofstream file(membersFile);
-        for (auto &m : members) {
-            file << m.name << "\n" << m.password << "\n" << m.role << "\n";
-        }
-    }
-
-    void loadBooks() {
-        books.clear();
-        ifstream file(booksFile);
-        if (!file) return;
-        Book b;
-        while (file >> b.id) {
-            file.ignore();
-            getline(file, b.title);
-            getline(file, b.author);
-            file >> b.totalCopies >> b.availableCopies;
-            file.ignore();
-            books.push_back(b);
-        }
-    }
-
-    void saveBooks() {
-        ofstream file(booksFile);
-        for (auto &b : books) {
-            file << b.id << "\n" << b.title << "\n" << b.author << "\n"
-                 << b.totalCopies << " " << b.availableCopies << "\n";
-        }
-    }
-
-    void loadTransactions() {
-        transactions.clear();
-        ifstream file(transactionsFile);
-        if (!file) return;
-        Transaction t;
-        while (file >> t.bookId) {
-            file.ignore();
-            getline(file, t.memberName);
-            getline(file, t.issueDate);
-            getline(file, t.returnDate);
-            transactions.push_back(t);
-        }
-    }
+    Library &lib;
 
-    void saveTransactions() {
-        ofstream file(transactionsFile);
-        for (auto &t : transactions) {
-            file << t.bookId << "\n" << t.memberName << "\n" << t.issueDate << "\n" << t.returnDate << "\n";
-        }
-    }
+    // Rows per page for the book, member and transaction listings (0 = no paging)
+    size_t pageSize;
 
     // // ---- Utility ----
     // void ensureFirstUser() {
@@ -245,26 +185,28 @@ public:
     //     }
     // }
 
-    Member* login() {
+    LoginResult login() {
         while (true) {
             string name = getNonEmptyLine("Username: ");
             string pass = getNonEmptyLine("Password: ");
 
-            for (auto &m : members) {
-                if (toLowerCase(m.name) == toLowerCase(name) &&
-                    toLowerCase(m.password) == toLowerCase(pass)) {
-                    cout << "Login successful (" << m.role << ").\n";
-                    pauseScreen();
-                    return &m;
-                }
+            LoginResult m = lib.login(name, pass);
+            if (m.error != LibraryError::BAD_CREDENTIALS) {
+                // a re-hash that could not be saved does not undo the login
+                if (!m.ok()) cout << "Error: " << m.message << ".\n";
+                cout << "Login successful (" << m.role << ").\n";
+                pauseScreen();
+                return m;
             }
             cout << "Invalid credentials. Try again.\n";
         }
     }
 
+public:
+    LibraryConsole(Library &library, size_t rowsPerPage = 20) : lib(library), pageSize(rowsPerPage) {}
+
     // ---- Menus (decorative) ----
     void homeMenu() {
-        
         int choice;
         do {
             clearScreen();
@@ -273,12 +215,12 @@ public:
             choice = getValidatedInt("Choose an option: ");
             switch (choice) {
                 case 1: {
-                    Member* current = login();
+                    LoginResult current = login();
                     // Show program banner once after login
                     printBanner();
-                    if (current->role == "admin") adminMenu();
-                    else if (current->role == "librarian") librarianMenu();
-                    else memberMenu(current);
+                    if (current.role == "admin") adminMenu();
+                    else if (current.role == "librarian") librarianMenu();
+                    else memberMenu(current.name);
                     break;
                 }
                 case 2:
@@ -287,6 +229,7 @@ public:
                     break;
                 case 0:
                 case 3: // in case user chooses 3 for Exit when printed as option 3
+                    if (!lib.flush()) cout << "Error: could not save library data.\n";
                     cout << "Exiting... Goodbye!\n";
                     pauseScreen();
                     exit(0);
@@ -296,12 +239,12 @@ public:
             }
         } while (true);
     }
-
     void adminMenu() {
         int choice;
         vector<string> opts = {
             "Add Member", "Add Book", "View Books", "Update Book",
-            "Delete Book", "View Reports", "View Members", "Search Book", "Logout"
+            "Delete Book", "View Reports", "View Members", "Search Book",
+            "Overdue Report", "Metrics", "Logout"
         };
         do {
             clearScreen();
@@ -316,7 +259,9 @@ public:
                 case 6: viewReports(); pauseScreen(); break;
                 case 7: viewMembers(); pauseScreen(); break;
                 case 8: searchBook(); pauseScreen(); break;
-                case 9:
+                case 9: viewOverdue(); pauseScreen(); break;
+                case 10: viewMetrics(); pauseScreen(); break;
+                case 11:
                 case 0:
                     cout << "Logging out...\n";
                     pauseScreen();
@@ -330,7 +275,8 @@ public:
         int choice;
         vector<string> opts = {
             "Add Book", "View Books", "Update Book", "Delete Book",
-            "Issue Book", "Return Book", "View Members", "Search Book", "Logout"
+            "Issue Book", "Return Book", "View Members", "Search Book",
+            "Overdue Report", "Logout"
         };
         do {
             clearScreen();
@@ -345,7 +291,8 @@ public:
                 case 6: returnBook(); pauseScreen(); break;
                 case 7: viewMembers(); pauseScreen(); break;
                 case 8: searchBook(); pauseScreen(); break;
-                case 9:
+                case 9: viewOverdue(); pauseScreen(); break;
+                case 10:
                 case 0:
                     cout << "Logging out...\n";
                     pauseScreen();
@@ -355,10 +302,10 @@ public:
         } while (true);
     }
 
-    void memberMenu(Member* m) {
+    void memberMenu(const string &memberName) {
         int choice;
         vector<string> opts = {
-            "View Books", "View My Borrowed Books", "Search Book", "Logout"
+            "View Books", "View My Borrowed Books", "Search Book", "Place Hold", "My Holds", "Logout"
         };
         do {
             clearScreen();
@@ -366,9 +313,11 @@ public:
             choice = getValidatedInt("Choose: ");
             switch (choice) {
                 case 1: viewBooks(); pauseScreen(); break;
-                case 2: viewBorrowedBooks(m->name); pauseScreen(); break;
+                case 2: viewBorrowedBooks(memberName); pauseScreen(); break;
                 case 3: searchBook(); pauseScreen(); break;
-                case 4:
+                case 4: placeHold(memberName); pauseScreen(); break;
+                case 5: viewHolds(memberName); pauseScreen(); break;
+                case 6:
                 case 0:
                     cout << "Logging out...\n";
                     pauseScreen();
@@ -378,15 +327,14 @@ public:
         } while (true);
     }
 
+
     // ---- Member ops ----
     void addMember() {
         clearScreen();
         string name = getNonEmptyLine("Enter username: ");
-        for (auto &m : members) {
-            if (toLowerCase(m.name) == toLowerCase(name)) {
-                cout << "Username already exists.\n";
-                return;
-            }
+        if (lib.getMember(name)) {
+            cout << "Username already exists.\n";
+            return;
         }
         string pass = getNonEmptyLine("Enter password: ");
         string role;
@@ -398,149 +346,237 @@ public:
             }
             cout << "Invalid role. Try again.\n";
         }
-        members.push_back({name, pass, toLowerCase(role)});
-        saveMembers();
-        cout << "Member added.\n";
+        Result r = lib.addMember(name, pass, role);
+        cout << (r.ok() ? "Member added.\n" : "Could not add member: " + r.message + ".\n");
     }
 
     // ---- Book ops ----
     void addBook() {
         clearScreen();
         int id = getValidatedInt("Enter book ID: ");
-        for (auto &b : books) {
-            if (b.id == id) {
-                cout << "Book ID already exists.\n";
-                return;
-            }
+        if (lib.getBook(id)) {
+            cout << "Book ID already exists.\n";
+            return;
         }
         string title = getNonEmptyLine("Enter title: ");
         string author = getNonEmptyLine("Enter author: ");
-        int copies = getValidatedInt("Enter number of copies: ");
-        if(copies <= 0) {
+        int count = getValidatedInt("Enter number of copies: ");
+        if(count <= 0) {
             cout << "Copies must be at least 1.\n";
             return;
         }
-        books.push_back({id, title, author, copies, copies});
-        saveBooks();
-        cout << "Book added.\n";
+        string location = getOptionalLine(string("Enter shelf location (Enter for ") + Library::DEFAULT_LOCATION + "): ");
+        Result r = lib.addBook(id, title, author, count, location);
+        cout << (r.ok() ? "Book added.\n" : "Could not add book: " + r.message + ".\n");
+    }
+
+    // ---- Listing filters ----
+    struct BookFilter {
+        int availability = 0;  // 0 all, 1 with copies available, 2 all copies issued
+        string author;         // case-insensitive substring, empty = any
+        int sortBy = 0;        // 0 added order, 1 id, 2 title, 3 author, 4 available copies (desc)
+    };
+
+    struct TransactionFilter {
+        string fromDate, toDate;  // inclusive date range, empty = open-ended
+        int dateField = 0;        // range on 0 issue date, 1 return date
+        int status = 0;           // 0 all, 1 open, 2 returned
+        string member;            // exact (case-insensitive), empty = any
+        int sortBy = 0;           // 0 recorded order, 1 issue date, 2 book id
+    };
+
+    struct MemberFilter {
+        string role;     // empty = any
+        int sortBy = 0;  // 0 file order, 1 name, 2 role
+    };
+
+    // Prompts shared by the listings: Enter keeps the default
+    static int promptChoice(const string &prompt, int maxChoice) {
+        string input = getOptionalLine(prompt);
+        int choice = 0;
+        return parseInt(input, choice) && choice >= 1 && choice <= maxChoice ? choice - 1 : 0;
+    }
+
+    static bool wantsFilter() {
+        return promptChoice("[1] Show all  [2] Filter / sort: ", 2) == 1;
+    }
+
+
+    // Reads a point-in-time view, so the listing is consistent however long it stays open
+    void listBooks(const BookFilter &filter) {
+        shared_ptr<const LibraryView> view = lib.readView();
+        const CowVector<Book> &books = view->books();
+        vector<size_t> rows;
+        rows.reserve(books.size());
+        for (size_t i = 0; i < books.size(); ++i) {
+            const Book &b = books[i];
+            if (filter.availability == 1 && view->availableCopies(b.id) <= 0) continue;
+            if (filter.availability == 2 && view->availableCopies(b.id) > 0) continue;
+            if (!filter.author.empty() && !containsIgnoreCase(b.author, filter.author)) continue;
+            rows.push_back(i);
+        }
+        auto sortRows = [&](auto less) { stable_sort(rows.begin(), rows.end(), less); };
+        if (filter.sortBy == 1) sortRows([&](size_t a, size_t b) { return books[a].id < books[b].id; });
+        if (filter.sortBy == 2) sortRows([&](size_t a, size_t b) { return books[a].title < books[b].title; });
+        if (filter.sortBy == 3) sortRows([&](size_t a, size_t b) { return books[a].author < books[b].author; });
+        if (filter.sortBy == 4) {
+            sortRows([&](size_t a, size_t b) {
+                return view->availableCopies(books[a].id) > view->availableCopies(books[b].id);
+            });
+        }
+
+        string header = "\nBooks List:\n";
+        appendCell(header, "ID", 6);
+        appendCell(header, "Title", 30);
+        appendCell(header, "Author", 25);
+        appendCell(header, "Available", 12);
+        appendCell(header, "Total", 12);
+        appendCell(header, "Issued", 12);
+        header += "\n" + string(97, '=') + "\n";
+        showPaged(header, rows.size(), 97, pageSize, [&](string &out, size_t row) {
+            const Book &b = books[rows[row]];
+            appendCell(out, b.id, 6);
+            appendCell(out, b.title, 30);
+            appendCell(out, b.author, 25);
+            appendCell(out, view->availableCopies(b.id), 12);
+            appendCell(out, view->totalCopies(b.id), 12);
+            appendCell(out, view->totalCopies(b.id) - view->availableCopies(b.id), 12);
+        });
     }
 
     void viewBooks() {
         clearScreen();
-        cout << "\nBooks List:\n";
-        cout << left << setw(6) << "ID" << setw(30) << "Title" << setw(25) << "Author"
-             << setw(12) << "Available" << setw(12) << "Total" << setw(12) << "Issued" << "\n";
-        cout << string(97, '=') << "\n";
-        for (auto &b : books) {
-            int issued = b.totalCopies - b.availableCopies;
-            cout << left << setw(6) << b.id
-                 << setw(30) << b.title
-                 << setw(25) << b.author
-                 << setw(12) << b.availableCopies
-                 << setw(12) << b.totalCopies
-                 << setw(12) << issued << "\n";
+        BookFilter filter;
+        if (wantsFilter()) {
+            filter.availability = promptChoice("Availability: [1] All [2] Available [3] All copies issued: ", 3);
+            filter.author = getOptionalLine("Author contains (Enter for any): ");
+            filter.sortBy = promptChoice("Sort by: [1] Added order [2] ID [3] Title [4] Author [5] Available copies: ", 5);
         }
+        clearScreen();
+        listBooks(filter);
     }
 
     void searchBook() {
         clearScreen();
         cout << "\n--- Search Book ---\n";
-        string keyword = getNonEmptyLine("Enter Book ID or Title: ");
+        cout << "Search in: [1] Title & Author  [2] Title  [3] Author\n";
+        int scope = getValidatedInt("Choose: ");
+        uint8_t fields = scope == 2 ? SearchIndex::FIELD_TITLE
+                       : scope == 3 ? SearchIndex::FIELD_AUTHOR : SearchIndex::FIELD_ANY;
+        string keyword = getNonEmptyLine("Enter Book ID or keywords: ");
         bool found = false;
 
-        bool isNumber = all_of(keyword.begin(), keyword.end(), ::isdigit);
         cout << left << setw(6) << "ID" << setw(30) << "Title" << setw(25) << "Author"
              << setw(12) << "Available" << setw(12) << "Total" << setw(12) << "Issued" << "\n";
         cout << string(97, '=') << "\n";
 
-        for (auto &b : books) {
-            if ((isNumber && to_string(b.id) == keyword) ||
-                (!isNumber && toLowerCase(b.title).find(toLowerCase(keyword)) != string::npos)) {
-                int issued = b.totalCopies - b.availableCopies;
-                cout << left << setw(6) << b.id
-                     << setw(30) << b.title
-                     << setw(25) << b.author
-                     << setw(12) << b.availableCopies
-                     << setw(12) << b.totalCopies
-                     << setw(12) << issued << "\n";
-                found = true;
-            }
+        auto printRow = [this](const Book &b) {
+            int issued = lib.totalCopies(b.id) - lib.availableCopies(b.id);
+            cout << left << setw(6) << b.id
+                 << setw(30) << b.title
+                 << setw(25) << b.author
+                 << setw(12) << lib.availableCopies(b.id)
+                 << setw(12) << lib.totalCopies(b.id)
+                 << setw(12) << issued << "\n";
+        };
+
+        // An exact ID match is listed first, then ranked keyword matches
+        int exactId = -1;
+        bool isNumber = keyword.size() <= 9 && all_of(keyword.begin(), keyword.end(), ::isdigit);
+        if (isNumber && lib.getBook(stoi(keyword))) {
+            exactId = stoi(keyword);
+            printRow(*lib.getBook(exactId));
+            printCopies(exactId);
+            found = true;
+        }
+        bool approximate = false;
+        for (auto &hit : lib.search(keyword, fields, found ? nullptr : &approximate)) {
+            const Book* b = lib.getBook(hit.bookId);
+            if (!b || hit.bookId == exactId) continue;
+            printRow(*b);
+            found = true;
         }
         if (!found) {
             cout << "No book found matching '" << keyword << "'.\n";
+        } else if (approximate) {
+            cout << "(no exact match for '" << keyword << "'; showing the closest spellings)\n";
+        }
+    }
+
+    // Lists every copy of book id with its barcode, status and location
+    void printCopies(int id) const {
+        const CopyTable &copies = lib.copyTable();
+        cout << "  Copies:";
+        for (int32_t barcode = 1; barcode <= (int32_t)copies.size(); ++barcode) {
+            const CopyTable::Copy &c = copies[barcode];
+            if (c.bookId != id || c.status == CopyTable::WITHDRAWN) continue;
+            cout << " #" << barcode << " (" << CopyTable::statusName(c.status) << ", " << copies.location(c) << ")";
         }
+        cout << "\n";
     }
 
     void updateBook() {
         clearScreen();
         int id = getValidatedInt("Enter book ID to update: ");
-        for (auto &b : books) {
-            if (b.id == id) {
-                string newTitle = getNonEmptyLine("Enter new title (leave blank to keep current): ");
-                if (!newTitle.empty()) b.title = newTitle;
-                string newAuthor = getNonEmptyLine("Enter new author (leave blank to keep current): ");
-                if (!newAuthor.empty()) b.author = newAuthor;
-                int newCopies = getValidatedInt("Enter new total copies: ");
-                if (newCopies >= 0) {
-                    int issuedCopies = b.totalCopies - b.availableCopies;
-                    if (newCopies < issuedCopies) {
-                        cout << "Cannot set total copies less than issued copies (" << issuedCopies << ").\n";
-                        return;
-                    }
-                    b.totalCopies = newCopies;
-                    b.availableCopies = newCopies - issuedCopies;
-                }
-                saveBooks();
-                cout << "Book updated.\n";
-                return;
-            }
+        if (!lib.getBook(id)) {
+            cout << "Book not found.\n";
+            return;
         }
-        cout << "Book not found.\n";
+        string newTitle = getNonEmptyLine("Enter new title (leave blank to keep current): ");
+        string newAuthor = getNonEmptyLine("Enter new author (leave blank to keep current): ");
+        int newCopies = getValidatedInt("Enter new total copies: ");
+        Result r = lib.updateBook(id, newTitle, newAuthor, newCopies);
+        if (r.error == LibraryError::COPIES_ON_LOAN) {
+            cout << "Cannot set total copies less than issued copies ("
+                 << lib.totalCopies(id) - lib.availableCopies(id) << ").\n";
+            return;
+        }
+        cout << (r.ok() ? "Book updated.\n" : "Could not update book: " + r.message + ".\n");
     }
 
     // ---- Fixed deleteBook (only delete available copies) ----
     void deleteBook() {
-        viewBooks();
+        clearScreen();
+        listBooks({});
         int id = getValidatedInt("Enter Book ID to delete copies from: ");
 
-        auto it = find_if(books.begin(), books.end(),
-                          [id](const Book &b) { return b.id == id; });
+        const Book* it = lib.getBook(id);
 
-        if (it != books.end()) {
-            int issuedCopies = it->totalCopies - it->availableCopies;
+        if (it) {
+            int available = lib.availableCopies(id);
+            int issuedCopies = lib.totalCopies(id) - available;
             cout << "Book found: " << it->title << " by " << it->author << "\n";
-            cout << "Total copies: " << it->totalCopies
-                 << ", Available copies: " << it->availableCopies
+            cout << "Total copies: " << lib.totalCopies(id)
+                 << ", Available copies: " << available
                  << ", Issued copies: " << issuedCopies << "\n";
 
             int toDelete = getValidatedInt("How many copies should be deleted? ");
-            if (toDelete <= 0) {
+            DeleteResult r = lib.deleteCopies(id, toDelete);
+            if (r.error == LibraryError::INVALID_INPUT) {
                 cout << "Invalid number. No copies deleted.\n";
                 return;
             }
 
             // Only allow deleting from available copies
-            if (toDelete > it->availableCopies) {
+            if (r.error == LibraryError::COPIES_ON_LOAN) {
                 cout << "Cannot delete " << toDelete << " copies.\n";
-                cout << "Only " << it->availableCopies << " copies are available to delete. "
+                cout << "Only " << available << " copies are available to delete. "
                      << issuedCopies << " copies are currently issued.\n";
                 return;
             }
+            if (!r.ok()) {
+                cout << "Could not delete copies: " << r.message << ".\n";
+                return;
+            }
 
-            it->totalCopies -= toDelete;
-            it->availableCopies -= toDelete;
-
-            if (it->totalCopies == 0) {
+            if (r.remaining == 0) {
                 // If total is zero (which implies issuedCopies was 0 because toDelete <= available),
-                // remove the record.
-                books.erase(it);
+                // the record has been removed.
                 cout << "All copies removed. Book deleted from library.\n";
             } else {
                 cout << "Deleted " << toDelete << " copies. "
-                     << "Remaining total: " << it->totalCopies << "\n";
+                     << "Remaining total: " << r.remaining << "\n";
             }
-
-            saveBooks();
         } else {
             cout << "Book not found.\n";
         }
@@ -549,128 +585,1219 @@ public:
 void issueBook() {
     clearScreen();
     int id = getValidatedInt("Enter book ID to issue: ");
-    for (auto &b : books) {
-        if (b.id == id) {
-            if (b.availableCopies <= 0) {
-                cout << "No copies available to issue.\n";
-                return;
-            }
-            string member = getNonEmptyLine("Enter member username to issue book to: ");
-            bool memberExists = false;
-            for (auto &m : members) {
-                if (toLowerCase(m.name) == toLowerCase(member)) {
-                    memberExists = true;
-                    break;
-                }
-            }
-            if (!memberExists) {
-                cout << "Member not found.\n";
-                return;
-            }
-            b.availableCopies--;
-            string issue_date = currentDate();
-            transactions.push_back({id, member, issue_date, ""});
-            saveBooks();
-            saveTransactions();
-            cout << "Book issued on " << issue_date << ".\n";
-            return;
-        }
+    if (!lib.getBook(id)) {
+        cout << "Book not found.\n";
+        return;
+    }
+    if (lib.availableCopies(id) <= 0) {
+        cout << "No copies available to issue (" << lib.holdsQueued(id) << " on hold).\n";
+        string answer = toLowerCase(getOptionalLine("Place a hold for a member instead? (y/n): "));
+        if (answer != "y" && answer != "yes") return;
+        string member = getNonEmptyLine("Enter member username: ");
+        Result hold = lib.placeHold(id, member, currentDate());
+        if (!hold.ok()) cout << "Could not place hold: " << hold.message << ".\n";
+        else cout << "Hold placed; position " << lib.holdPosition(id, member) << " in the queue.\n";
+        return;
+    }
+    string member = getNonEmptyLine("Enter member username to issue book to: ");
+    string issue_date = currentDate();
+    IssueResult r = lib.issueBook(id, member, issue_date);
+    if (r.error == LibraryError::MEMBER_NOT_FOUND) {
+        cout << "Member not found.\n";
+        return;
+    }
+    if (r.error == LibraryError::RESERVED) {
+        cout << "This copy is reserved for " << lib.holdHead(id) << " (first in the hold queue).\n";
+        return;
     }
-    cout << "Book not found.\n";
+    if (!r.ok()) {
+        cout << "Could not issue book: " << r.message << ".\n";
+        return;
+    }
+    cout << "Copy " << r.copy << " issued on " << issue_date << ".\n";
 }
 
     void returnBook() {
     clearScreen();
     int id = getValidatedInt("Enter book ID to return: ");
     string member = getNonEmptyLine("Enter member username returning the book: ");
-    for (auto &b : books) {
-        if (b.id == id) {
-            bool found = false;
-            for (auto &t : transactions) {
-                if (t.bookId == id && toLowerCase(t.memberName) == toLowerCase(member) && t.returnDate.empty()) {
-                    string return_date = currentDate();
-                    t.returnDate = return_date;
-                    b.availableCopies++;
-
-                    // Calculate fine
-                    const int allowed_days = 14;  // 14 days allowed borrowing period
-                    const int fine_per_day = 10;  // fine amount per late day
-                    int diff = daysBetween(t.issueDate, return_date);
-                    int late_days = diff - allowed_days;
-                    if (late_days > 0) {
-                        int fine = late_days * fine_per_day;
-                        cout << "Book returned late by " << late_days << " days.\n";
-                        cout << "Fine to be paid: " << fine << " units.\n";
-                    } else {
-                        cout << "Book returned on time. No fine.\n";
-                    }
+    string return_date = currentDate();
+    ReturnResult r = lib.returnBook(id, member, return_date);
+    if (r.error == LibraryError::BOOK_NOT_FOUND) {
+        cout << "Book not found.\n";
+        return;
+    }
+    if (r.error == LibraryError::NOT_ON_LOAN) {
+        cout << "No outstanding issue record found for this book and member.\n";
+        return;
+    }
+    cout << "Copy " << r.copy << " returned";
+    if (!r.servedHold.empty()) cout << " and issued to " << r.servedHold << ", first in the hold queue";
+    cout << ".\n";
+    if (!r.ok()) cout << "Error: " << r.message << ".\n";
 
-                    saveBooks();
-                    saveTransactions();
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                cout << "No outstanding issue record found for this book and member.\n";
+    // Calculate fine
+    if (r.lateDays > 0) {
+        cout << "Book returned late by " << r.lateDays << " days.\n";
+        cout << "Fine to be paid: " << r.fine << " units.\n";
+    } else {
+        cout << "Book returned on time. No fine.\n";
+    }
+}
+
+    void listTransactions(const TransactionFilter &filter) {
+        // a date range is cut out of the sorted date indexes and only the
+        // archive segments it overlaps are read; otherwise every loan is a candidate
+        int fromDay = filter.fromDate.empty() ? numeric_limits<int>::min() : parseDay(filter.fromDate);
+        int toDay = filter.toDate.empty() ? numeric_limits<int>::max() : parseDay(filter.toDate);
+        auto field = filter.dateField == 1 && (!filter.fromDate.empty() || !filter.toDate.empty())
+            ? BY_RETURN_DATE : BY_ISSUE_DATE;
+        vector<LoanRecord> rows = lib.readView()->loanHistory(fromDay, toDay, field);
+        rows.erase(remove_if(rows.begin(), rows.end(), [&](const LoanRecord &t) {
+            return (filter.status == 1 && !t.open()) || (filter.status == 2 && t.open()) ||
+                   (!filter.member.empty() && !equalsIgnoreCase(t.member, filter.member));
+        }), rows.end());
+        if (filter.sortBy == 1) {
+            stable_sort(rows.begin(), rows.end(), [](const LoanRecord &a, const LoanRecord &b) {
+                return a.issueDay < b.issueDay;
+            });
+        } else if (filter.sortBy == 2) {
+            stable_sort(rows.begin(), rows.end(), [](const LoanRecord &a, const LoanRecord &b) {
+                return a.bookId < b.bookId;
+            });
+        }
+
+        string header = "\nTransactions:\n";
+        appendCell(header, "BookID", 8);
+        appendCell(header, "Copy", 8);
+        appendCell(header, "Member", 20);
+        appendCell(header, "Issued", 15);
+        appendCell(header, "Returned", 15);
+        header += "\n" + string(66, '=') + "\n";
+        showPaged(header, rows.size(), 66, pageSize, [&](string &out, size_t row) {
+            const LoanRecord &t = rows[row];
+            appendCell(out, t.bookId, 8);
+            if (t.copy != CopyTable::NONE) appendCell(out, t.copy, 8);
+            else appendCell(out, "-", 8);
+            appendCell(out, t.member, 20);
+            appendCell(out, dayLabel(t.issueDay), 15);
+            appendCell(out, t.open() ? "-" : dayLabel(t.returnDay), 15);
+        });
+    }
+
+    void viewAnalytics() {
+        const CirculationStats &stats = lib.circulationStats();
+        int today = parseDay(currentDate());
+        string out = "\nCirculation Analytics:\n" + string(60, '=') + "\n";
+        out += "Total loans: " + to_string(stats.totalLoans()) + "   Open: " +
+               to_string(stats.totalLoans() - stats.returnedLoans()) + "   Returned: " +
+               to_string(stats.returnedLoans()) + "\n";
+        char avg[32];
+        snprintf(avg, sizeof(avg), "%.1f", stats.averageLoanDays());
+        out += "Average loan duration: " + string(avg) + " days\n";
+
+        auto titleOf = [this](int id) {
+            const Book* b = lib.getBook(id);
+            return b ? b->title : string_view("(deleted)");
+        };
+        out += "\nMost borrowed titles:\n";
+        for (auto &r : stats.topBorrowed(10)) {
+            appendCell(out, "  " + to_string(r.bookId), 10);
+            appendCell(out, titleOf(r.bookId), 32);
+            out += to_string((long long)r.value) + " loans\n";
+        }
+        out += "\nHighest utilization (share of copy-days on loan):\n";
+        auto copiesOf = [this](int id) { return lib.totalCopies(id); };
+        for (auto &r : stats.topUtilization(10, today, copiesOf)) {
+            appendCell(out, "  " + to_string(r.bookId), 10);
+            appendCell(out, titleOf(r.bookId), 32);
+            snprintf(avg, sizeof(avg), "%.1f%%", r.value * 100);
+            out += string(avg) + "\n";
+        }
+        out += "\nLoans per month (last 12):\n";
+        auto &months = stats.loansByMonth();
+        auto it = months.end();
+        for (int shown = 0; it != months.begin() && shown < 12; ++shown) --it;
+        for (; it != months.end(); ++it) {
+            out += "  " + monthLabel(it->first) + "  " + to_string(it->second) + "\n";
+        }
+        cout << out;
+
+        string member = getOptionalLine("\nMember for monthly history (Enter to skip): ");
+        if (member.empty()) return;
+        auto history = stats.memberMonths(member);
+        if (history.empty()) cout << "No loans recorded for " << member << ".\n";
+        for (auto &entry : history) cout << "  " << monthLabel(entry.first) << "  " << entry.second << "\n";
+    }
+
+    void viewReports() {
+        clearScreen();
+        if (promptChoice("[1] Transactions  [2] Circulation analytics: ", 2) == 1) {
+            clearScreen();
+            viewAnalytics();
+            return;
+        }
+        TransactionFilter filter;
+        if (wantsFilter()) {
+            filter.dateField = promptChoice("Date range on: [1] Issue date [2] Return date: ", 2);
+            const char* which = filter.dateField == 1 ? "Returned" : "Issued";
+            filter.fromDate = getOptionalLine(string(which) + " from (YYYY-MM-DD, Enter for any): ");
+            filter.toDate = getOptionalLine(string(which) + " to (YYYY-MM-DD, Enter for any): ");
+            if ((!filter.fromDate.empty() && !isDateString(filter.fromDate)) ||
+                (!filter.toDate.empty() && !isDateString(filter.toDate))) {
+                cout << "Invalid date.\n";
+                return;
             }
+            filter.status = promptChoice("Status: [1] All [2] Open [3] Returned: ", 3);
+            filter.member = getOptionalLine("Member (Enter for any): ");
+            filter.sortBy = promptChoice("Sort by: [1] Recorded order [2] Issue date [3] Book ID: ", 3);
+        }
+        clearScreen();
+        listTransactions(filter);
+    }
+
+
+    void viewOverdue() {
+        clearScreen();
+        string date = getOptionalLine("Overdue as of (YYYY-MM-DD, Enter for today): ");
+        if (date.empty()) date = currentDate();
+        int asOf = parseDay(date);
+        if (asOf == INVALID_DAY) {
+            cout << "Invalid date.\n";
             return;
         }
+        cout << "\nOverdue loans as of " << date << ":\n";
+        cout << left << setw(8) << "BookID" << setw(30) << "Title" << setw(20) << "Member"
+             << setw(12) << "Issued" << setw(12) << "Due" << setw(10) << "Days Late" << setw(8) << "Fine" << "\n";
+        cout << string(100, '=') << "\n";
+        long long totalFine = 0;
+        auto loans = lib.overdueAsOf(asOf);
+        for (auto &loan : loans) {
+            const Book* b = lib.getBook(loan.bookId);
+            cout << left << setw(8) << loan.bookId << setw(30) << (b ? b->title : "Unknown")
+                 << setw(20) << loan.memberName << setw(12) << loan.issueDate << setw(12) << civilDate(loan.dueDay)
+                 << setw(10) << loan.lateDays << setw(8) << loan.fine << "\n";
+            totalFine += loan.fine;
+        }
+        if (loans.empty()) {
+            cout << "No overdue loans.\n";
+        } else {
+            cout << "\n" << loans.size() << " overdue loans, " << totalFine << " units accrued.\n";
+        }
     }
-    cout << "Book not found.\n";
-}
 
-    void viewReports() {
+    void viewMetrics() {
         clearScreen();
-        cout << "\nTransactions:\n";
-        cout << left << setw(8) << "BookID" << setw(20) << "Member" << setw(15) << "Issued" << setw(15) << "Returned" << "\n";
-        cout << string(58, '=') << "\n";
-        for (auto &t : transactions) {
-            cout << left << setw(8) << t.bookId
-                 << setw(20) << t.memberName
-                 << setw(15) << t.issueDate
-                 << setw(15) << (t.returnDate.empty() ? "-" : t.returnDate) << "\n";
+        cout << "\nRecords:\n";
+        for (auto &c : lib.recordCounts()) cout << "  " << left << setw(18) << c.first << c.second << "\n";
+#if LIBRARY_METRICS
+        cout << "\nOperations (since start):\n";
+        cout << left << setw(10) << "Op" << setw(18) << "File" << right << setw(10) << "Calls" << setw(12) << "p50 us"
+             << setw(12) << "p99 us" << setw(12) << "max us" << setw(12) << "total ms" << "\n";
+        cout << string(86, '=') << "\n";
+        for (int op = 0; op < METRIC_OPS; ++op) {
+            const LatencyHistogram &h = Metrics::of((MetricOp)op);
+            if (!h.count()) continue;
+            cout << left << setw(10) << METRIC_LABELS[op].first << setw(18) << METRIC_LABELS[op].second << right
+                 << setw(10) << h.count() << fixed << setprecision(1) << setw(12) << h.quantileMicros(0.5)
+                 << setw(12) << h.quantileMicros(0.99) << setw(12) << h.maxMicros() << setw(12)
+                 << h.seconds() * 1e3 << "\n" << defaultfloat;
         }
+#else
+        cout << "\nLatency metrics are compiled out (LIBRARY_METRICS=0).\n";
+#endif
+        int format = promptChoice("\n[1] Back  [2] Save as Prometheus text  [3] Save as JSON: ", 3);
+        if (format == 0) return;
+        string path = getOptionalLine(format == 1 ? "File (Enter for metrics.prom): " : "File (Enter for metrics.json): ");
+        if (path.empty()) path = format == 1 ? "metrics.prom" : "metrics.json";
+        if (format == 2 && (path.size() < 5 || path.compare(path.size() - 5, 5, ".json") != 0)) {
+            cout << "JSON metrics need a .json file name.\n";
+            return;
+        }
+        if (lib.writeMetrics(path)) cout << "Metrics written to " << path << ".\n";
+        else cout << "Could not write " << path << ".\n";
     }
 
     void viewBorrowedBooks(string memberName) {
         clearScreen();
         cout << "\nBorrowed Books for " << memberName << ":\n";
         bool found = false;
-        cout << left << setw(8) << "BookID" << setw(30) << "Title" << setw(15) << "Issued Date" << "\n";
-        cout << string(53, '=') << "\n";
-        for (auto &t : transactions) {
-            if (toLowerCase(t.memberName) == toLowerCase(memberName) && t.returnDate.empty()) {
-                string title = "Unknown";
-                for (auto &b : books) {
-                    if (b.id == t.bookId) {
-                        title = b.title;
-                        break;
-                    }
-                }
-                cout << left << setw(8) << t.bookId << setw(30) << title << setw(15) << t.issueDate << "\n";
-                found = true;
-            }
+        cout << left << setw(8) << "BookID" << setw(8) << "Copy" << setw(30) << "Title" << setw(15) << "Issued Date"
+             << "\n";
+        cout << string(61, '=') << "\n";
+        for (auto &t : lib.openLoans(memberName)) {
+            const Book* b = lib.getBook(t.bookId);
+            cout << left << setw(8) << t.bookId << setw(8) << t.copy << setw(30) << (b ? b->title : "Unknown")
+                 << setw(15) << t.issueDate << "\n";
+            found = true;
         }
         if (!found) {
             cout << "No borrowed books.\n";
         }
     }
 
+    void placeHold(const string &memberName) {
+        clearScreen();
+        int id = getValidatedInt("Enter book ID to place a hold on: ");
+        Result r = lib.placeHold(id, memberName, currentDate());
+        if (!r.ok()) {
+            cout << "Could not place hold: " << r.message << ".\n";
+            return;
+        }
+        cout << "Hold placed; you are number " << lib.holdPosition(id, memberName)
+             << " in the queue. The book will be issued to you when a copy is returned.\n";
+    }
+
+    void viewHolds(const string &memberName) {
+        clearScreen();
+        auto mine = lib.holdsOf(memberName);
+        cout << "\nHolds for " << memberName << ":\n";
+        cout << left << setw(8) << "BookID" << setw(30) << "Title" << setw(12) << "Placed" << setw(10) << "Position" << "\n";
+        cout << string(60, '=') << "\n";
+        for (auto &h : mine) {
+            const Book* b = lib.getBook(h.bookId);
+            cout << left << setw(8) << h.bookId << setw(30) << (b ? b->title : "Unknown") << setw(12)
+                 << dayLabel(h.holdDay) << lib.holdPosition(h.bookId, memberName) << " of " << lib.holdsQueued(h.bookId)
+                 << "\n";
+        }
+        if (mine.empty()) {
+            cout << "No holds.\n";
+            return;
+        }
+        string answer = getOptionalLine("\nBook ID to cancel (Enter to keep all): ");
+        int id;
+        if (answer.empty()) return;
+        if (!parseInt(answer, id)) {
+            cout << "Invalid book ID.\n";
+            return;
+        }
+        Result r = lib.cancelHold(id, memberName);
+        cout << (r.ok() ? "Hold cancelled.\n" : "Could not cancel: " + r.message + ".\n");
+    }
+
+    void listMembers(const MemberFilter &filter) {
+        const CowVector<Member> &members = lib.allMembers();
+        vector<size_t> rows;
+        rows.reserve(members.size());
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (filter.role.empty() || members[i].role == filter.role) rows.push_back(i);
+        }
+        if (filter.sortBy == 1) {
+            stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b) {
+                return toLowerCase(string(members[a].name)) < toLowerCase(string(members[b].name));
+            });
+        } else if (filter.sortBy == 2) {
+            stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b) {
+                return members[a].role < members[b].role;
+            });
+        }
+
+        string header = "\nMembers List:\n";
+        appendCell(header, "Username", 20);
+        appendCell(header, "Role", 15);
+        header += "\n" + string(35, '=') + "\n";
+        showPaged(header, rows.size(), 35, pageSize, [&](string &out, size_t row) {
+            const Member &m = members[rows[row]];
+            appendCell(out, m.name, 20);
+            appendCell(out, m.role, 15);
+        });
+    }
+
     void viewMembers() {
         clearScreen();
-        cout << "\nMembers List:\n";
-        cout << left << setw(20) << "Username" << setw(15) << "Role" << "\n";
-        cout << string(35, '=') << "\n";
-        for (auto &m : members) {
-            cout << left << setw(20) << m.name << setw(15) << m.role << "\n";
+        MemberFilter filter;
+        if (wantsFilter()) {
+            static const char* roles[] = {"", "admin", "librarian", "member"};
+            filter.role = roles[promptChoice("Role: [1] All [2] Admin [3] Librarian [4] Member: ", 4)];
+            filter.sortBy = promptChoice("Sort by: [1] File order [2] Name [3] Role: ", 3);
+        }
+        clearScreen();
+        listMembers(filter);
+    }
+};
+
+// ===== Batch mode =====
+// Column order for each CSV operation (the first column is always the op)
+const unordered_map<string, vector<string>> BATCH_COLUMNS = {
+    {"add-book", {"id", "title", "author", "copies", "location"}},
+    {"add-member", {"name", "password", "role"}},
+    {"issue", {"id", "member", "date"}},
+    {"return", {"id", "member", "date"}},
+    {"search", {"query"}},
+    {"overdue", {"date"}},
+    {"hold", {"id", "member", "date"}},
+    {"cancel-hold", {"id", "member"}},
+    {"loans", {"from", "to", "by"}},
+};
+
+// Applies a stream of CSV or JSON Lines operations through the Library API,
+// without the menus.
+class BatchRunner {
+private:
+    Library &lib;
+
+    // Applies one operation; returns an error message, or "" on success
+    string apply(const unordered_map<string, string> &f, const string &today, ostream &out) {
+        auto get = [&f](const char* key) {
+            auto it = f.find(key);
+            return it == f.end() ? string() : it->second;
+        };
+        string op = get("op");
+        int id = 0;
+        if (op == "add-book") {
+            int count = 0;
+            if (!parseInt(get("id"), id) || !parseInt(get("copies"), count)) return "add-book needs numeric id and copies";
+            return lib.addBook(id, get("title"), get("author"), count, get("location")).message;
+        } else if (op == "add-member") {
+            return lib.addMember(get("name"), get("password"), get("role")).message;
+        } else if (op == "issue" || op == "return") {
+            string date = get("date");
+            if (!parseInt(get("id"), id)) return op + " needs a numeric book id";
+            if (date.empty()) date = today;
+            return op == "issue" ? lib.issueBook(id, get("member"), date).message
+                                 : lib.returnBook(id, get("member"), date).message;
+        } else if (op == "hold") {
+            string date = get("date");
+            if (!parseInt(get("id"), id)) return "hold needs a numeric book id";
+            return lib.placeHold(id, get("member"), date.empty() ? today : date).message;
+        } else if (op == "cancel-hold") {
+            if (!parseInt(get("id"), id)) return "cancel-hold needs a numeric book id";
+            return lib.cancelHold(id, get("member")).message;
+        } else if (op == "search") {
+            string query = get("query");
+            bool approximate = false;
+            vector<SearchIndex::Hit> hits = lib.search(query, SearchIndex::FIELD_ANY, &approximate);
+            out << "search '" << query << "'" << (approximate ? " (approximate)" : "") << ":";
+            for (auto &hit : hits) out << ' ' << hit.bookId;
+            out << '\n';
+        } else if (op == "overdue") {
+            string date = get("date");
+            if (date.empty()) date = today;
+            int asOf = parseDay(date);
+            if (asOf == INVALID_DAY) return "date must be YYYY-MM-DD";
+            long long fines = 0;
+            auto loans = lib.overdueAsOf(asOf);
+            for (auto &loan : loans) fines += loan.fine;
+            out << "overdue " << date << ": " << loans.size() << " loans, " << fines << " units accrued\n";
+        } else if (op == "loans") {
+            string from = get("from"), to = get("to"), by = get("by");
+            if (!isDateString(from) || !isDateString(to)) return "loans needs from and to dates (YYYY-MM-DD)";
+            if (!by.empty() && by != "issued" && by != "returned") return "loans by must be issued or returned";
+            auto field = by == "returned" ? BY_RETURN_DATE : BY_ISSUE_DATE;
+            auto loans = lib.loansBetween(parseDay(from), parseDay(to), field);
+            out << "loans " << (field == BY_RETURN_DATE ? "returned " : "issued ") << from << ".." << to
+                << ": " << loans.size() << "\n";
+            for (auto &t : loans) {
+                out << "  " << t.bookId << ' ' << t.copy << ' ' << t.memberName << ' ' << t.issueDate << ' '
+                    << (t.returnDate.empty() ? "-" : t.returnDate) << '\n';
+            }
+        } else {
+            return "unknown op '" + op + "'";
+        }
+        return "";
+    }
+
+public:
+    struct BatchStats {
+        size_t ok = 0, failed = 0, persists = 0;
+        double seconds = 0;
+    };
+
+    explicit BatchRunner(Library &library) : lib(library) {}
+
+    // State is persisted every batchSize operations (0 = once at the end)
+    BatchStats run(istream &in, size_t batchSize, ostream &out, ostream &err) {
+        BatchStats stats;
+        lib.setDeferPersist(true);
+        auto start = chrono::steady_clock::now();
+        string today = currentDate();
+        string line;
+        size_t lineNo = 0, pending = 0;
+        unordered_map<string, string> fields;
+        while (getline(in, line)) {
+            ++lineNo;
+            if (line.empty() || line[0] == '#' || line == "\r") continue;
+            fields.clear();
+            string error;
+            if (line[0] == '{') {
+                if (!parseJsonObject(line, fields)) error = "malformed JSON";
+            } else {
+                vector<string> cols = parseCsvLine(line);
+                if (lineNo == 1 && cols[0] == "op") continue;  // header row
+                fields["op"] = cols[0];
+                auto layout = BATCH_COLUMNS.find(cols[0]);
+                if (layout != BATCH_COLUMNS.end()) {
+                    for (size_t c = 0; c < layout->second.size() && c + 1 < cols.size(); ++c) {
+                        fields[layout->second[c]] = cols[c + 1];
+                    }
+                }
+            }
+            if (error.empty()) error = apply(fields, today, out);
+            if (error.empty()) {
+                ++stats.ok;
+            } else {
+                ++stats.failed;
+                err << "line " << lineNo << ": " << error << "\n";
+            }
+            if (++pending == batchSize) {
+                if (!lib.compact()) err << "line " << lineNo << ": could not save library data\n";
+                ++stats.persists;
+                pending = 0;
+            }
+        }
+        lib.setDeferPersist(false);
+        if (pending > 0) {
+            if (!lib.compact()) err << "could not save library data\n";
+            ++stats.persists;
+        }
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+};
+
+// ===== Benchmark =====
+// Synthetic dataset generator plus latency/throughput measurements of the
+// Library hot paths, driven through the console-free API (no menus).
+class Benchmark {
+private:
+    mt19937 rng{12345};
+
+    // Zipf(s=1) sampler over [0, n): a few items get most of the traffic
+    class Zipf {
+        vector<double> cdf;
+    public:
+        explicit Zipf(size_t n) : cdf(max<size_t>(n, 1)) {
+            double sum = 0;
+            for (size_t i = 0; i < cdf.size(); ++i) cdf[i] = (sum += 1.0 / (i + 1));
+            for (auto &c : cdf) c /= sum;
+        }
+        size_t operator()(mt19937 &rng) const {
+            double u = uniform_real_distribution<double>(0, 1)(rng);
+            return min<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+        }
+    };
+
+    vector<string> vocabulary;
+    vector<string> memberNames;
+    static constexpr size_t HASHED_MEMBERS = 16;
+
+    static string tempDir() {
+        auto dir = filesystem::temp_directory_path() /
+                   ("library-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+        filesystem::create_directories(dir);
+        return dir.string();
+    }
+
+    string pseudoWord() {
+        static const char* syllables[] = {"ka", "lo", "mi", "ra", "ten", "dor", "vel", "an", "is", "qu",
+                                          "sha", "ber", "ton", "li", "mar", "go", "ne", "zu", "pel", "ria"};
+        string word;
+        int parts = 2 + (int)(rng() % 2);
+        for (int i = 0; i < parts; ++i) word += syllables[rng() % 20];
+        return word;
+    }
+
+    struct Stat {
+        string name;
+        vector<double> micros;
+        double seconds = 0;
+    };
+
+    template <typename F>
+    Stat measure(const string &name, size_t ops, F fn) {
+        Stat stat{name, {}, 0};
+        stat.micros.reserve(ops);
+        auto begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < ops; ++i) {
+            auto t0 = chrono::steady_clock::now();
+            fn(i);
+            stat.micros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+        }
+        stat.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        return stat;
+    }
+
+    static void print(const Stat &s) {
+        vector<double> v = s.micros;
+        sort(v.begin(), v.end());
+        auto pct = [&v](double p) { return v.empty() ? 0.0 : v[min(v.size() - 1, (size_t)(p * v.size()))]; };
+        cout << left << setw(18) << s.name << right << setw(8) << v.size() << fixed << setprecision(1)
+             << setw(12) << pct(0.50) << setw(12) << pct(0.90) << setw(12) << pct(0.99)
+             << setw(12) << (v.empty() ? 0.0 : v.back()) << setprecision(0)
+             << setw(14) << (s.seconds > 0 ? v.size() / s.seconds : 0.0) << "\n";
+    }
+
+public:
+    // Writes members.txt, books.txt and transactions.txt for n books, m members
+    // and t transactions. Popularity of books and activity of members are
+    // Zipf-skewed; the last month of loans is left partly open.
+    void generate(const string &dir, size_t n, size_t m, size_t t) {
+        vocabulary.clear();
+        for (size_t i = 0; i < 5000; ++i) vocabulary.push_back(pseudoWord());
+        Zipf wordPick(vocabulary.size());
+
+        memberNames.clear();
+        // the first few members get real hashes (cheap cost) for the login
+        // benchmark; the rest stay in the legacy plaintext form
+        ofstream members(dir + "/members.txt");
+        for (size_t i = 0; i < m; ++i) {
+            memberNames.push_back("user" + to_string(i));
+            string pass = "pass" + to_string(i);
+            members << memberNames.back() << "\n" << (i < HASHED_MEMBERS ? hashPassword(pass, 1000) : pass)
+                    << "\n" << (i % 50 == 0 ? "librarian" : "member") << "\n";
+        }
+
+        vector<int> total(n), available(n);
+        vector<string> titles(n), authors(n);
+        size_t authorCount = max<size_t>(n / 20, 1);
+        for (size_t i = 0; i < n; ++i) {
+            int words = 1 + (int)(rng() % 4);
+            for (int w = 0; w < words; ++w) titles[i] += (w ? " " : "") + vocabulary[wordPick(rng)];
+            titles[i][0] = (char)toupper((unsigned char)titles[i][0]);
+            size_t a = rng() % authorCount;
+            authors[i] = vocabulary[a % vocabulary.size()] + " " + vocabulary[(a * 7919) % vocabulary.size()];
+            total[i] = available[i] = 1 + (int)(rng() % 5);
+        }
+
+        Zipf bookPick(n), memberPick(m);
+        int today = daysFromCivil(2024, 12, 31), span = 730;
+        ofstream transactions(dir + "/transactions.txt");
+        for (size_t i = 0; i < t && n && m; ++i) {
+            size_t b = bookPick(rng);
+            int issued = today - span + (int)(i * span / t);
+            bool open = issued > today - 30 && available[b] > 0 && rng() % 2 == 0;
+            if (open) --available[b];
+            transactions << (b + 1) << "\n" << memberNames[memberPick(rng)] << "\n" << civilDate(issued) << "\n"
+                         << (open ? "" : civilDate(issued + 1 + (int)(rng() % 30))) << "\n";
+        }
+
+        ofstream books(dir + "/books.txt");
+        for (size_t i = 0; i < n; ++i) {
+            books << (i + 1) << "\n" << titles[i] << "\n" << authors[i] << "\n"
+                  << total[i] << " " << available[i] << "\n";
+        }
+    }
+
+    void runScale(size_t n) {
+        size_t m = max<size_t>(n / 10, 1), t = n * 2;
+        const size_t ops = 2000;
+        string path = tempDir();
+
+        auto genStart = chrono::steady_clock::now();
+        generate(path, n, m, t);
+        double genSeconds = chrono::duration<double>(chrono::steady_clock::now() - genStart).count();
+
+        cout << "\n== " << n << " books, " << m << " members, " << t << " transactions (generated in "
+             << fixed << setprecision(2) << genSeconds << " s) ==\n";
+        cout << left << setw(18) << "operation" << right << setw(8) << "ops" << setw(12) << "p50 us"
+             << setw(12) << "p90 us" << setw(12) << "p99 us" << setw(12) << "max us" << setw(14) << "ops/s" << "\n";
+
+        const size_t compactNever = (size_t)1 << 40;
+        print(measure("load (text)", 3, [&](size_t) { Library lib(true, compactNever, path); }));
+        Library lib(true, compactNever, path);
+        print(measure("save (text)", 3, [&](size_t) { lib.compact(); }));
+        print(measure("save (snapshot)", 3, [&](size_t) { lib.convertToSnapshot(); }));
+        print(measure("load (snapshot)", 3, [&](size_t) { Library snap(true, compactNever, path); }));
+
+        Zipf wordPick(vocabulary.size()), memberPick(m), bookPick(n);
+        vector<string> queries;
+        for (size_t i = 0; i < ops; ++i) {
+            string q = vocabulary[wordPick(rng)];
+            if (i % 3 == 0) q = q.substr(0, 3);                            // prefix
+            if (i % 5 == 0) q += " " + vocabulary[wordPick(rng)];          // two words
+            queries.push_back(q);
+        }
+        print(measure("search", ops, [&](size_t i) { lib.search(queries[i]); }));
+        vector<string> typos;
+        for (size_t i = 0; i < ops; ++i) {
+            string q = vocabulary[wordPick(rng)];
+            q[rng() % q.size()] = (char)('a' + rng() % 26);                 // one substitution
+            if (i % 5 == 0) q += " " + vocabulary[wordPick(rng)];
+            typos.push_back(q);
         }
+        bool approximate = false;
+        print(measure("search (typo)", ops, [&](size_t i) {
+            lib.search(typos[i], SearchIndex::FIELD_ANY, &approximate);
+        }));
+
+        string today = currentDate();
+        vector<pair<int, string>> issued;
+        print(measure("issue", ops, [&](size_t) {
+            int id = (int)bookPick(rng) + 1;
+            const string &member = memberNames[memberPick(rng)];
+            if (lib.issueBook(id, member, today).ok()) issued.push_back({id, member});
+        }));
+        print(measure("return", issued.size(), [&](size_t i) {
+            lib.returnBook(issued[i].first, issued[i].second, today);
+        }));
+        print(measure("report (borrowed)", ops, [&](size_t) { lib.openLoans(memberNames[memberPick(rng)]); }));
+        int todayDay = parseDay(today);
+        print(measure("report (overdue)", 200, [&](size_t) { lib.overdueAsOf(todayDay); }));
+        int firstDay = daysFromCivil(2024, 12, 31) - 730;
+        print(measure("report (30 days)", 200, [&](size_t i) {
+            int from = firstDay + (int)(i * 7 % 700);
+            lib.loansBetween(from, from + 29, i % 2 ? BY_RETURN_DATE : BY_ISSUE_DATE);
+        }));
+        print(measure("report (top 10)", 200, [&](size_t) { lib.circulationStats().topBorrowed(10); }));
+        size_t hashed = min(HASHED_MEMBERS, m);
+        print(measure("login (kdf 1000)", 200, [&](size_t i) {
+            lib.authenticate(memberNames[i % hashed], "pass" + to_string(i % hashed));
+        }));
+
+        filesystem::remove_all(path);
+    }
+
+    // Many threads logging in at once against members hashed with the given
+    // KDF cost; one in ten attempts uses a wrong password.
+    void runLoginStorm(size_t threads, uint32_t iterations, double seconds = 3.0) {
+        threads = max<size_t>(threads, 1);
+        string path = tempDir();
+        {
+            ofstream members(path + "/members.txt");
+            for (size_t i = 0; i < HASHED_MEMBERS; ++i) {
+                members << "user" << i << "\n" << hashPassword("pass" + to_string(i), iterations) << "\nmember\n";
+            }
+        }
+        Library lib(true, (size_t)1 << 40, path);
+        lib.setKdfIterations(iterations);
+
+        vector<vector<double>> latencies(threads);
+        vector<size_t> accepted(threads, 0);
+        atomic<bool> stop{false};
+        vector<thread> workers;
+        auto begin = chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (size_t k = 0; !stop.load(memory_order_relaxed); ++k) {
+                    size_t i = (t * 7 + k) % HASHED_MEMBERS;
+                    string pass = k % 10 == 9 ? "wrong" : "pass" + to_string(i);
+                    auto t0 = chrono::steady_clock::now();
+                    if (lib.authenticate("user" + to_string(i), pass)) ++accepted[t];
+                    latencies[t].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+                }
+            });
+        }
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop = true;
+        for (auto &w : workers) w.join();
+
+        Stat stat{"login", {}, chrono::duration<double>(chrono::steady_clock::now() - begin).count()};
+        size_t ok = 0;
+        for (size_t t = 0; t < threads; ++t) {
+            stat.micros.insert(stat.micros.end(), latencies[t].begin(), latencies[t].end());
+            ok += accepted[t];
+        }
+        cout << "\n== Login storm: " << threads << " threads, PBKDF2 " << iterations << " iterations, "
+             << ok << " accepted ==\n";
+        cout << left << setw(18) << "operation" << right << setw(8) << "ops" << setw(12) << "p50 us"
+             << setw(12) << "p90 us" << setw(12) << "p99 us" << setw(12) << "max us" << setw(14) << "ops/s" << "\n";
+        print(stat);
+        filesystem::remove_all(path);
     }
 };
 
+#ifndef _WIN32
+// ===== Circulation server =====
+// Line protocol over loopback TCP. One request per line, fields separated by
+// tabs (escaped like journal records). Replies start with "OK" or "ERR";
+// listings reply "OK <n>" followed by n tab-separated rows.
+//
+//   PING | VIEW | SEARCH q | BOOK id | BORROWED member | LOGIN name pass
+//   LOANS from to [issued|returned] | METRICS [json]
+//   ISSUE id member | RETURN id member | HOLD id member | CANCELHOLD id member
+//   ADDBOOK id title author copies [location] | ADDMEMBER name pass role | QUIT
+//   BRANCHES | BRANCH name | FIND q | WHERE id
+//
+// BORROWED rows are "bookId title issueDate barcode"; LOANS rows are
+// "bookId barcode member issueDate returnDate" in date order.
+// RETURN replies "OK <late days> <fine>", plus a tab and the member the copy
+// was issued to when someone was waiting for it.
+//
+// Each connection works on one branch (the first until BRANCH switches it);
+// FIND and WHERE ask every branch. FIND rows are "branch bookId title author
+// available total", WHERE rows "branch available total".
+//
+// Reads share the branch's lock so VIEW/SEARCH run concurrently; writers take
+// it exclusively, which makes each availability check-and-update atomic.
+// VIEW and LOANS only hold the lock long enough to take a read view of the
+// branch and answer from that (LOANS reading archive segments from disk as
+// needed), so writers are not held up by long listings or reports.
+// Branches have separate locks and journals, so writers at different branches
+// never wait on each other. A writer replies only once its journal record is
+// on disk, waiting after releasing the lock so that concurrent writers share
+// one fsync.
+class LibraryServer {
+private:
+    BranchCatalog &branches;
+    size_t threadCount;
+    int listenFd = -1;
+
+    // accepted connections waiting for a worker
+    queue<int> pendingClients;
+    mutex queueMutex;
+    condition_variable clientReady;
+
+    // from is the Library or a LibraryView of it
+    template <typename Source>
+    static string bookRow(const Source &from, const Book &b) {
+        return makeRecord({to_string(b.id), string(b.title), string(b.author),
+                           to_string(from.availableCopies(b.id)), to_string(from.totalCopies(b.id))});
+    }
+
+    static string listing(const vector<string> &rows) {
+        string out = "OK " + to_string(rows.size()) + "\n";
+        for (auto &row : rows) out += row + "\n";
+        return out;
+    }
+
+    static string error(const string &message) { return "ERR " + message + "\n"; }
+
+    static string result(const Result &r, const string &ok = "OK") {
+        return r.ok() ? ok + "\n" : error(r.message);
+    }
+
+    // Runs a mutation under the branch's exclusive lock and waits for it to be durable
+    template <typename F>
+    static string write(BranchCatalog::Branch &branch, F mutate) {
+        string reply;
+        uint64_t before, seq;
+        {
+            unique_lock<shared_mutex> lock(branch.lock);
+            before = branch.lib->journalSequence();
+            reply = mutate();
+            seq = branch.lib->journalSequence();
+        }
+        // a request that journaled nothing has nothing to wait for
+        if (seq != before && !branch.lib->waitDurable(seq)) return error("could not save library data");
+        return reply;
+    }
+
+    // current is the connection's branch
+    string handle(const vector<string> &f, size_t &current) {
+        string cmd = f[0];
+        for (auto &c : cmd) c = (char)toupper((unsigned char)c);
+        int id = 0;
+        BranchCatalog::Branch &branch = branches[current];
+        Library &lib = *branch.lib;
+        shared_mutex &stateMutex = branch.lock;
+
+        if (cmd == "PING") return "OK PONG\n";
+        if (cmd == "BRANCHES") {
+            vector<string> rows;
+            for (size_t i = 0; i < branches.size(); ++i) rows.push_back(escapeField(branches[i].name));
+            return listing(rows);
+        }
+        if (cmd == "BRANCH" && f.size() == 2) {
+            size_t found = branches.find(f[1]);
+            if (found == branches.size()) return error("no branch '" + f[1] + "'");
+            current = found;
+            return "OK " + escapeField(branches[found].name) + "\n";
+        }
+        if (cmd == "FIND" && f.size() == 2) {
+            vector<string> rows;
+            for (auto &hit : branches.search(f[1])) {
+                rows.push_back(makeRecord({branches[hit.branch].name, to_string(hit.bookId), hit.title, hit.author,
+                                           to_string(hit.available), to_string(hit.total)}));
+            }
+            return listing(rows);
+        }
+        if (cmd == "WHERE" && f.size() == 2 && parseInt(f[1], id)) {
+            vector<string> rows;
+            for (auto &stock : branches.availability(id)) {
+                rows.push_back(makeRecord({branches[stock.branch].name, to_string(stock.available),
+                                           to_string(stock.total)}));
+            }
+            return listing(rows);
+        }
+        if (cmd == "METRICS" && (f.size() == 1 || (f.size() == 2 && f[1] == "json"))) {
+            string report;
+            {
+                shared_lock<shared_mutex> lock(stateMutex);
+                report = lib.metricsReport(f.size() == 2);
+            }
+            vector<string> rows;
+            size_t pos = 0, nl;
+            while ((nl = report.find('\n', pos)) != string::npos) {
+                rows.push_back(report.substr(pos, nl - pos));
+                pos = nl + 1;
+            }
+            return listing(rows);
+        }
+        if (cmd == "VIEW") {
+            // the listing is built from a read view, outside the lock
+            shared_ptr<const LibraryView> view;
+            {
+                shared_lock<shared_mutex> lock(stateMutex);
+                view = lib.readView();
+            }
+            vector<string> rows;
+            rows.reserve(view->books().size());
+            for (auto &b : view->books()) rows.push_back(bookRow(*view, b));
+            return listing(rows);
+        }
+        if (cmd == "SEARCH" && f.size() == 2) {
+            shared_lock<shared_mutex> lock(stateMutex);
+            vector<string> rows;
+            bool approximate = false;
+            for (auto &hit : lib.search(f[1], SearchIndex::FIELD_ANY, &approximate)) {
+                if (const Book* b = lib.getBook(hit.bookId)) rows.push_back(bookRow(lib, *b));
+            }
+            return listing(rows);
+        }
+        if (cmd == "BOOK" && f.size() == 2 && parseInt(f[1], id)) {
+            shared_lock<shared_mutex> lock(stateMutex);
+            const Book* b = lib.getBook(id);
+            return b ? listing({bookRow(lib, *b)}) : error("book not found");
+        }
+        if (cmd == "LOANS" && (f.size() == 3 || f.size() == 4) && isDateString(f[1]) && isDateString(f[2]) &&
+            (f.size() == 3 || f[3] == "issued" || f[3] == "returned")) {
+            auto field = f.size() == 4 && f[3] == "returned" ? BY_RETURN_DATE : BY_ISSUE_DATE;
+            // the range, and any archive segments it needs, is read after the lock is released
+            shared_ptr<const LibraryView> view;
+            {
+                shared_lock<shared_mutex> lock(stateMutex);
+                view = lib.readView();
+            }
+            vector<string> rows;
+            for (auto &t : view->loansBetween(parseDay(f[1]), parseDay(f[2]), field)) {
+                rows.push_back(makeRecord({to_string(t.bookId), to_string(t.copy), string(t.memberName), t.issueDate,
+                                           t.returnDate}));
+            }
+            return listing(rows);
+        }
+        if (cmd == "BORROWED" && f.size() == 2) {
+            shared_lock<shared_mutex> lock(stateMutex);
+            vector<string> rows;
+            for (auto &t : lib.openLoans(f[1])) {
+                const Book* b = lib.getBook(t.bookId);
+                rows.push_back(makeRecord({to_string(t.bookId), string(b ? b->title : "Unknown"), t.issueDate,
+                                           to_string(t.copy)}));
+            }
+            return listing(rows);
+        }
+        if (cmd == "LOGIN" && f.size() == 3) {
+            string role;
+            bool rehash = false;
+            {
+                shared_lock<shared_mutex> lock(stateMutex);
+                const Member* m = lib.authenticate(f[1], f[2]);
+                if (!m) return error("invalid credentials");
+                role = m->role;
+                rehash = lib.needsRehash(*m);
+            }
+            if (!rehash) return "OK " + role + "\n";
+            return write(branch, [&] { return result(lib.upgradeCredential(f[1], f[2]), "OK " + role); });
+        }
+        if (cmd == "ISSUE" && f.size() == 3 && parseInt(f[1], id)) {
+            string date = currentDate();
+            return write(branch, [&] { return result(lib.issueBook(id, f[2], date), "OK " + date); });
+        }
+        if (cmd == "RETURN" && f.size() == 3 && parseInt(f[1], id)) {
+            string date = currentDate();
+            return write(branch, [&] {
+                ReturnResult r = lib.returnBook(id, f[2], date);
+                string ok = "OK " + to_string(r.lateDays) + " " + to_string(r.fine);
+                return result(r, r.servedHold.empty() ? ok : ok + "\t" + escapeField(r.servedHold));
+            });
+        }
+        if (cmd == "HOLD" && f.size() == 3 && parseInt(f[1], id)) {
+            string date = currentDate();
+            return write(branch, [&] { return result(lib.placeHold(id, f[2], date)); });
+        }
+        if (cmd == "CANCELHOLD" && f.size() == 3 && parseInt(f[1], id)) {
+            return write(branch, [&] { return result(lib.cancelHold(id, f[2])); });
+        }
+        int count = 0;
+        if (cmd == "ADDBOOK" && (f.size() == 5 || f.size() == 6) && parseInt(f[1], id) && parseInt(f[4], count)) {
+            return write(branch, [&] { return result(lib.addBook(id, f[2], f[3], count, f.size() == 6 ? f[5] : "")); });
+        }
+        if (cmd == "ADDMEMBER" && f.size() == 4) {
+            return write(branch, [&] { return result(lib.addMember(f[1], f[2], f[3])); });
+        }
+        return error("bad request '" + f[0] + "'");
+    }
+
+    static bool sendAll(int fd, const string &data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    void serveClient(int fd) {
+        size_t branch = 0;
+        string buffer;
+        char chunk[4096];
+        bool open = true;
+        while (open) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) break;
+            buffer.append(chunk, (size_t)n);
+            size_t pos = 0, nl;
+            while (open && (nl = buffer.find('\n', pos)) != string::npos) {
+                string line = buffer.substr(pos, nl - pos);
+                pos = nl + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                vector<string> fields = splitRecord(line);
+                if (equalsIgnoreCase(fields[0], "QUIT")) {
+                    sendAll(fd, "OK BYE\n");
+                    open = false;
+                } else {
+                    open = sendAll(fd, handle(fields, branch));
+                }
+            }
+            buffer.erase(0, pos);
+        }
+        ::close(fd);
+    }
+
+    void worker() {
+        while (true) {
+            int fd;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                clientReady.wait(lock, [this] { return !pendingClients.empty(); });
+                fd = pendingClients.front();
+                pendingClients.pop();
+            }
+            serveClient(fd);
+        }
+    }
+
+public:
+    LibraryServer(BranchCatalog &catalog, size_t threads)
+        : branches(catalog), threadCount(threads ? threads : 4) {
+        for (size_t i = 0; i < branches.size(); ++i) branches[i].lib->setGroupCommit(true);
+    }
+
+    bool listen(uint16_t port, string &error) {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) { error = "cannot create socket"; return false; }
+        int yes = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listenFd, 64) != 0) {
+            error = "cannot listen on 127.0.0.1:" + to_string(port);
+            ::close(listenFd);
+            return false;
+        }
+        return true;
+    }
+
+    // Starts the worker pool and accepts connections until the process exits
+    void run() {
+        for (size_t i = 0; i < threadCount; ++i) {
+            thread(&LibraryServer::worker, this).detach();
+        }
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                pendingClients.push(fd);
+            }
+            clientReady.notify_one();
+        }
+    }
+};
+#endif
+
 // ===== main =====
-int main() {
-    Library lib;
-    lib.homeMenu();
+int main(int argc, char* argv[]) {
+    bool journaled = true;
+    size_t compactEvery = 1000;
+    string convert, batchFile, benchScales, dataDir, finesDate, metricsOut, branchList, branch;
+    string exportDir, importDir;
+    BulkFormat exportFormat = BulkFormat::CSV;
+    size_t batchSize = 0, pageSize = 20;
+    int servePort = 0, archiveAfter = 0;
+    size_t serveThreads = thread::hardware_concurrency(), loginStormThreads = 0;
+    uint32_t kdfIterations = DEFAULT_KDF_ITERATIONS;
+    bool migrate = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--convert-snapshot" || arg == "--convert-text") {
+            convert = arg;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchFile = argv[++i];
+        } else if (arg == "--batch-size" && i + 1 < argc) {
+            batchSize = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--bench") {
+            benchScales = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) ? argv[++i] : "1000,10000,100000";
+        } else if (arg == "--fines") {
+            finesDate = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) ? argv[++i] : currentDate();
+        } else if (arg == "--page-size" && i + 1 < argc) {
+            pageSize = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--bench-login") {
+            loginStormThreads = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) ? strtoul(argv[++i], nullptr, 10) : 8;
+        } else if (arg == "--kdf-iterations" && i + 1 < argc) {
+            kdfIterations = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--migrate-passwords") {
+            migrate = true;
+        } else if (arg == "--data-dir" && i + 1 < argc) {
+            dataDir = argv[++i];
+        } else if (arg == "--branches" && i + 1 < argc) {
+            branchList = argv[++i];
+        } else if (arg == "--branch" && i + 1 < argc) {
+            branch = argv[++i];
+        } else if (arg == "--serve") {
+            servePort = (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) ? atoi(argv[++i]) : 7070;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            serveThreads = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--no-journal") {
+            journaled = false;
+        } else if (arg == "--compact-every" && i + 1 < argc) {
+            compactEvery = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--metrics-out" && i + 1 < argc) {
+            metricsOut = argv[++i];
+        } else if (arg == "--archive-after" && i + 1 < argc) {
+            archiveAfter = atoi(argv[++i]);
+        } else if (arg == "--export" && i + 1 < argc) {
+            exportDir = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            exportFormat = string(argv[++i]) == "jsonl" ? BulkFormat::JSON_LINES : BulkFormat::CSV;
+        } else if (arg == "--import" && i + 1 < argc) {
+            importDir = argv[++i];
+        }
+    }
+    if (!benchScales.empty()) {
+        Benchmark bench;
+        for (auto &scale : parseCsvLine(benchScales)) {
+            size_t n = strtoul(scale.c_str(), nullptr, 10);
+            if (n) bench.runScale(n);
+        }
+        return 0;
+    }
+    if (loginStormThreads) {
+        Benchmark().runLoginStorm(loginStormThreads, kdfIterations);
+        return 0;
+    }
+    // each branch keeps its files in its own subdirectory of the data directory
+    string root = dataDir.empty() ? "." : dataDir;
+    if (servePort) {
+#ifdef _WIN32
+        cerr << "Server mode is not supported on Windows.\n";
+        return 1;
+#else
+        vector<pair<string, string>> dirs;
+        for (auto &name : parseCsvLine(branchList.empty() ? branch : branchList)) {
+            if (!name.empty()) dirs.push_back({name, root + "/" + name});
+        }
+        if (dirs.empty()) dirs.push_back({"main", dataDir});
+        BranchCatalog catalog(dirs, journaled, compactEvery);
+        for (size_t i = 0; i < catalog.size(); ++i) {
+            Library &lib = *catalog[i].lib;
+            lib.setKdfIterations(kdfIterations);
+            if (!lib.warning().empty()) cout << "Warning: " << catalog[i].name << ": " << lib.warning() << ".\n";
+            lib.setArchiveHorizon(archiveAfter);
+            if (size_t moved = lib.archiveClosedLoans()) {
+                cout << catalog[i].name << ": archived " << moved << " closed loan(s).\n";
+            }
+        }
+        LibraryServer server(catalog, serveThreads);
+        string error;
+        if (!server.listen((uint16_t)servePort, error)) {
+            cerr << error << "\n";
+            return 1;
+        }
+        cout << "Serving on 127.0.0.1:" << servePort << "\n" << flush;
+        server.run();
+#endif
+    }
+    if (!branch.empty()) {
+        dataDir = root + "/" + branch;
+        filesystem::create_directories(dataDir);
+    } else if (!importDir.empty() && !dataDir.empty()) {
+        filesystem::create_directories(dataDir);  // importing sets up a new library
+    }
+    Library lib(journaled, compactEvery, dataDir);
+    if (!lib.warning().empty()) cout << "Warning: " << lib.warning() << ".\n";
+    lib.setKdfIterations(kdfIterations);
+    lib.setArchiveHorizon(archiveAfter);
+    if (size_t moved = lib.archiveClosedLoans()) cout << "Archived " << moved << " closed loan(s).\n";
+    if (migrate) {
+        MigrateResult r = lib.migratePasswords();
+        if (!r.ok()) {
+            cerr << "Error: " << r.message << ".\n";
+            return 1;
+        }
+        cout << "Hashed " << r.migrated << " plaintext password(s).\n";
+        return 0;
+    }
+    if (convert == "--convert-snapshot") {
+        if (!lib.convertToSnapshot()) {
+            cerr << "Error: could not save library data.\n";
+            return 1;
+        }
+        cout << "Wrote library.snap (" << lib.memberCount() << " members, " << lib.bookCount()
+             << " books, " << lib.transactionCount() << " transactions).\n";
+        return 0;
+    }
+    if (convert == "--convert-text") {
+        if (!lib.convertToText()) {
+            cerr << "Error: could not save library data.\n";
+            return 1;
+        }
+        cout << "Wrote members.txt, books.txt and transactions.txt; removed library.snap.\n";
+        return 0;
+    }
+    if (!exportDir.empty() || !importDir.empty()) {
+        TransferResult r = importDir.empty() ? lib.exportTo(exportDir, exportFormat) : lib.importFrom(importDir);
+        const size_t shownProblems = 20;
+        for (size_t i = 0; i < r.problems.size() && i < shownProblems; ++i) cerr << r.problems[i] << "\n";
+        if (r.problems.size() > shownProblems) cerr << "... and " << r.problems.size() - shownProblems << " more\n";
+        if (!r.ok()) {
+            cerr << "Error: " << r.message << "\n";
+            return 1;
+        }
+        size_t rows = 0;
+        for (auto &t : r.tables) {
+            rows += t.rows;
+            cout << t.file << ": " << t.rows << " rows in " << fixed << setprecision(3) << t.seconds << " s ("
+                 << setprecision(0) << (t.seconds > 0 ? t.rows / t.seconds : 0.0) << " rows/s)\n";
+        }
+        cout << (importDir.empty() ? "Exported " : "Imported ") << rows << " rows in " << setprecision(3)
+             << r.seconds << " s (" << setprecision(0) << (r.seconds > 0 ? rows / r.seconds : 0.0) << " rows/s)\n";
+        return 0;
+    }
+    if (!finesDate.empty()) {
+        int asOf = parseDay(finesDate);
+        if (asOf == INVALID_DAY) {
+            cerr << "Date must be YYYY-MM-DD\n";
+            return 1;
+        }
+        Library::FineTotals totals = lib.computeFines(asOf, cout);
+        cerr << totals.loans << " loans, " << totals.lateLoans << " late, "
+             << totals.fines << " units in fines as of " << finesDate << "\n";
+        return 0;
+    }
+    if (!batchFile.empty()) {
+        ifstream file;
+        istream* in = &cin;
+        if (batchFile != "-") {
+            file.open(batchFile);
+            if (!file) {
+                cerr << "Cannot open " << batchFile << "\n";
+                return 1;
+            }
+            in = &file;
+        }
+        BatchRunner::BatchStats stats = BatchRunner(lib).run(*in, batchSize, cout, cerr);
+        size_t total = stats.ok + stats.failed;
+        cout << "Batch: " << total << " ops (" << stats.ok << " ok, " << stats.failed << " failed), "
+             << stats.persists << " persist(s) in " << fixed << setprecision(3) << stats.seconds << " s ("
+             << setprecision(0) << (stats.seconds > 0 ? total / stats.seconds : 0.0) << " ops/s)\n";
+        if (!metricsOut.empty() && !lib.writeMetrics(metricsOut)) cerr << "Cannot write " << metricsOut << "\n";
+        return stats.failed ? 2 : 0;
+    }
+    LibraryConsole(lib, pageSize).homeMenu();
     return 0;
 }
@@ -0,0 +1,3519 @@
+#include "library_core.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// Times the rest of the enclosing block; nothing when LIBRARY_METRICS is 0
+#if LIBRARY_METRICS
+#define METRIC_SCOPE_AT(op, line) Metrics::Scope metricScope##line(op)
+#define METRIC_SCOPE_LINE(op, line) METRIC_SCOPE_AT(op, line)
+#define METRIC_SCOPE(op) METRIC_SCOPE_LINE(op, __LINE__)
+#else
+#define METRIC_SCOPE(op) ((void)0)
+#endif
+
+// ===== Helpers =====
+string currentDate() {
+    time_t now = time(nullptr);
+    tm ltm = {};
+#ifdef _WIN32
+    localtime_s(&ltm, &now);
+#else
+    localtime_r(&now, &ltm);  // safe to call from server worker threads
+#endif
+    char buffer[11];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d", &ltm);
+    return string(buffer);
+}
+
+int daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+void civilFromDays(int days, int &y, int &m, int &d) {
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int doe = days - era * 146097;
+    const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp + (mp < 10 ? 3 : -9);
+    y = yoe + era * 400 + (m <= 2);
+}
+
+string civilDate(int days) {
+    int y, m, d;
+    civilFromDays(days, y, m, d);
+    if (y >= 0 && y <= 9999) {
+        // formatted by hand: runs for every date written out or displayed
+        const char text[10] = {char('0' + y / 1000), char('0' + y / 100 % 10), char('0' + y / 10 % 10),
+                               char('0' + y % 10), '-', char('0' + m / 10), char('0' + m % 10), '-',
+                               char('0' + d / 10), char('0' + d % 10)};
+        return string(text, sizeof(text));
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", y, m, d);
+    return buffer;
+}
+
+bool isDateString(string_view s) {
+    if (s.size() != 10 || s[4] != '-' || s[7] != '-') return false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (i != 4 && i != 7 && !isdigit((unsigned char)s[i])) return false;
+    }
+    return true;
+}
+
+int parseDay(string_view date) {
+    if (!isDateString(date)) return INVALID_DAY;
+    auto num = [&date](size_t pos, size_t len) {
+        int v = 0;
+        for (size_t i = pos; i < pos + len; ++i) v = v * 10 + (date[i] - '0');
+        return v;
+    };
+    return daysFromCivil(num(0, 4), num(5, 2), num(8, 2));
+}
+
+int parseReturnDay(string_view date) {
+    return date.empty() ? OPEN_LOAN : parseDay(date);
+}
+
+string dayLabel(int day) {
+    if (day == OPEN_LOAN) return "";
+    return day == INVALID_DAY ? "unknown" : civilDate(day);
+}
+
+int monthOfDay(int days) {
+    int y, m, d;
+    civilFromDays(days, y, m, d);
+    return y * 12 + (m - 1);
+}
+
+string monthLabel(int month) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d", month / 12, month % 12 + 1);
+    return buffer;
+}
+
+int lateDays(int issueDay, int returnDay) {
+    if (issueDay == INVALID_DAY || returnDay == INVALID_DAY) return 0;
+    return max(0, returnDay - issueDay - LOAN_PERIOD_DAYS);
+}
+
+string toLowerCase(string str) {
+    transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+bool equalsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+bool containsIgnoreCase(string_view haystack, string_view needle) {
+    auto it = search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
+                     [](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); });
+    return it != haystack.end() || needle.empty();
+}
+
+size_t CaseInsensitiveHash::operator()(string_view s) const {
+    size_t h = 14695981039346656037ULL;
+    for (unsigned char c : s) {
+        h ^= (size_t)tolower(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool CaseInsensitiveEqual::operator()(string_view a, string_view b) const {
+    return equalsIgnoreCase(a, b);
+}
+
+// ---- Journal record encoding ----
+string escapeField(const string &s) {
+    string out;
+    out.reserve(s.size());
+    for (char c : s) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\t') out += "\\t";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+vector<string> splitRecord(const string &line) {
+    vector<string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '\t') {
+            fields.emplace_back();
+        } else if (c == '\\' && i + 1 < line.size()) {
+            char e = line[++i];
+            fields.back() += (e == 't') ? '\t' : (e == 'n') ? '\n' : e;
+        } else {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+string makeRecord(const vector<string> &fields) {
+    string out;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i) out += '\t';
+        out += escapeField(fields[i]);
+    }
+    return out;
+}
+
+// ---- Batch input and bulk file parsing ----
+bool parseInt(string_view s, int &out) {
+    auto res = from_chars(s.data(), s.data() + s.size(), out);
+    return !s.empty() && res.ec == errc() && res.ptr == s.data() + s.size();
+}
+
+bool readWholeFile(const string &path, string &out) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) return false;
+    out.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(&out[0], (streamsize)out.size());
+    out.resize((size_t)file.gcount());
+    return true;
+}
+
+string csvField(string_view s) {
+    if (s.find_first_of(",\"\r\n") == string::npos) return string(s);
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void appendUtf8(string &out, unsigned cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+bool parseCsvLine(string &data, BulkCursor &at, vector<string_view> &fields) {
+    fields.clear();
+    size_t i = at.pos, n = data.size();
+    for (; i < n && (data[i] == '\n' || data[i] == '\r'); ++i) {
+        if (data[i] == '\n') ++at.lineBreaks;
+    }
+    at.pos = i;
+    if (i >= n) return false;
+    at.recordLine = at.lineBreaks + 1;
+    // out trails i: unquoted text is copied down over the quotes already passed
+    size_t start = i, out = i;
+    bool quoted = false;
+    for (; i < n; ++i) {
+        char c = data[i];
+        if (quoted) {
+            if (c != '"') {
+                if (c == '\n') ++at.lineBreaks;
+                data[out++] = c;
+            } else if (i + 1 < n && data[i + 1] == '"') {
+                data[out++] = data[++i];
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.emplace_back(data.data() + start, out - start);
+            start = out = i + 1;
+        } else if (c == '\n') {
+            break;
+        } else if (c != '\r') {
+            data[out++] = c;
+        }
+    }
+    fields.emplace_back(data.data() + start, out - start);
+    if (i < n) {
+        ++at.lineBreaks;
+        ++i;
+    }
+    at.pos = i;
+    return true;
+}
+
+vector<string> parseCsvLine(const string &line) {
+    string data = line;
+    BulkCursor at;
+    vector<string_view> fields;
+    if (!parseCsvLine(data, at, fields)) return vector<string>(1);
+    return vector<string>(fields.begin(), fields.end());
+}
+
+bool parseJsonObject(string &data, BulkCursor &at, vector<pair<string_view, string_view>> &fields,
+                     bool &malformed) {
+    fields.clear();
+    malformed = false;
+    size_t i = at.pos, n = data.size();
+    for (; i < n && isspace((unsigned char)data[i]); ++i) {
+        if (data[i] == '\n') ++at.lineBreaks;
+    }
+    at.pos = i;
+    if (i >= n) return false;
+    at.recordLine = at.lineBreaks + 1;
+    // a raw line break cannot occur inside a JSON string, so the record ends at one
+    size_t end = data.find('\n', i);
+    if (end == string::npos) end = n;
+    at.pos = end < n ? end + 1 : n;
+    if (end < n) ++at.lineBreaks;
+
+    auto skipSpace = [&]() {
+        while (i < end && isspace((unsigned char)data[i])) ++i;
+    };
+    auto hex4 = [&](size_t from, unsigned &cp) {
+        if (from + 4 > end) return false;
+        auto res = from_chars(data.data() + from, data.data() + from + 4, cp, 16);
+        return res.ptr == data.data() + from + 4;
+    };
+    auto parseString = [&](string_view &dst) {
+        if (i >= end || data[i] != '"') return false;
+        size_t start = ++i, out = i;
+        for (; i < end && data[i] != '"'; ++i) {
+            char c = data[i];
+            if (c != '\\') {
+                data[out++] = c;
+                continue;
+            }
+            if (++i >= end) return false;
+            switch (data[i]) {
+                case 'n': data[out++] = '\n'; break;
+                case 't': data[out++] = '\t'; break;
+                case 'r': data[out++] = '\r'; break;
+                case 'b': data[out++] = '\b'; break;
+                case 'f': data[out++] = '\f'; break;
+                case 'u': {
+                    unsigned cp = 0, low = 0;
+                    if (!hex4(i + 1, cp)) return false;
+                    i += 4;
+                    // a surrogate pair spells one code point past the BMP
+                    if (cp >= 0xD800 && cp < 0xDC00 && i + 2 < end && data[i + 1] == '\\' && data[i + 2] == 'u' &&
+                        hex4(i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                    // at most 4 bytes for the 6 or 12 just read, so this never overtakes i
+                    string utf8;
+                    appendUtf8(utf8, cp);
+                    for (char b : utf8) data[out++] = b;
+                    break;
+                }
+                default: data[out++] = data[i];
+            }
+        }
+        if (i >= end) return false;
+        ++i;  // closing quote
+        dst = string_view(data.data() + start, out - start);
+        return true;
+    };
+    auto parseObject = [&]() {
+        skipSpace();
+        if (i >= end || data[i++] != '{') return false;
+        skipSpace();
+        if (i < end && data[i] == '}') return true;
+        while (true) {
+            string_view key, value;
+            skipSpace();
+            if (!parseString(key)) return false;
+            skipSpace();
+            if (i >= end || data[i++] != ':') return false;
+            skipSpace();
+            if (i < end && data[i] == '"') {
+                if (!parseString(value)) return false;
+            } else {
+                size_t start = i;
+                while (i < end && data[i] != ',' && data[i] != '}') ++i;
+                size_t last = i;
+                while (last > start && isspace((unsigned char)data[last - 1])) --last;
+                value = string_view(data.data() + start, last - start);
+                // nested objects and arrays are not part of the format
+                if (value.empty() || value[0] == '{' || value[0] == '[') return false;
+            }
+            fields.emplace_back(key, value);
+            skipSpace();
+            if (i >= end) return false;
+            if (data[i] == '}') return true;
+            if (data[i++] != ',') return false;
+        }
+    };
+    if (!parseObject()) {
+        malformed = true;
+        return true;
+    }
+    ++i;  // closing brace
+    skipSpace();
+    malformed = i < end;
+    return true;
+}
+
+bool parseJsonObject(const string &line, unordered_map<string, string> &out) {
+    string data = line;
+    BulkCursor at;
+    vector<pair<string_view, string_view>> fields;
+    bool malformed;
+    if (!parseJsonObject(data, at, fields, malformed) || malformed) return false;
+    for (auto &f : fields) out[string(f.first)] = string(f.second);
+    return true;
+}
+
+void appendJsonString(string &out, string_view s) {
+    static const char HEX[] = "0123456789abcdef";
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    out += "\\u00";
+                    out += HEX[(unsigned char)c >> 4];
+                    out += HEX[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// ===== Compact string storage =====
+string_view StringArena::add(string_view text) {
+    if (text.empty()) return string_view();
+    char* dest;
+    if (text.size() > BLOCK_SIZE / 4) {
+        // oversized text gets its own block, ahead of the one being filled
+        auto at = blocks.empty() ? blocks.end() : blocks.end() - 1;
+        dest = blocks.insert(at, unique_ptr<char[]>(new char[text.size()]))->get();
+    } else {
+        if (used + text.size() > BLOCK_SIZE) {
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            used = 0;
+        }
+        dest = blocks.back().get() + used;
+        used += text.size();
+    }
+    memcpy(dest, text.data(), text.size());
+    total += text.size();
+    return string_view(dest, text.size());
+}
+
+size_t StringArena::bytes() const {
+    return total;
+}
+
+// ===== Copy-on-write storage =====
+uint32_t StringPool::intern(string_view text) {
+    auto it = ids.find(text);
+    if (it != ids.end()) return it->second;
+    string_view stored = arena.add(text);
+    uint32_t id = (uint32_t)values.size();
+    values.push_back(stored);
+    ids.emplace(stored, id);
+    return id;
+}
+
+string_view StringPool::view(string_view text) {
+    return values[intern(text)];
+}
+
+string_view StringPool::operator[](uint32_t id) const {
+    return values[id];
+}
+
+size_t StringPool::size() const {
+    return values.size();
+}
+
+size_t StringPool::bytes() const {
+    return arena.bytes();
+}
+
+CowVector<string_view> StringPool::snapshot() const {
+    return values.snapshot();
+}
+
+bool Transaction::open() const {
+    return returnDay == OPEN_LOAN;
+}
+
+bool LoanRecord::open() const {
+    return returnDay == OPEN_LOAN;
+}
+
+// ===== Password hashing =====
+void pbkdf2Sha256(const string &password, const string &salt, uint32_t iterations, unsigned char out[32]) {
+    unsigned char key[64] = {0};
+    if (password.size() > 64) {
+        Sha256 h;
+        h.update(password.data(), password.size());
+        h.finish(key);
+    } else {
+        memcpy(key, password.data(), password.size());
+    }
+    unsigned char ipad[64], opad[64];
+    for (int i = 0; i < 64; ++i) {
+        ipad[i] = key[i] ^ 0x36;
+        opad[i] = key[i] ^ 0x5c;
+    }
+    Sha256 inner, outer;
+    inner.update(ipad, 64);
+    outer.update(opad, 64);
+    auto hmac = [&](const void* msg, size_t len, const void* msg2, size_t len2, unsigned char mac[32]) {
+        Sha256 h = inner;
+        h.update(msg, len);
+        if (len2) h.update(msg2, len2);
+        h.finish(mac);
+        h = outer;
+        h.update(mac, 32);
+        h.finish(mac);
+    };
+
+    const unsigned char blockIndex[4] = {0, 0, 0, 1};
+    unsigned char u[32];
+    hmac(salt.data(), salt.size(), blockIndex, 4, u);
+    memcpy(out, u, 32);
+    for (uint32_t i = 1; i < iterations; ++i) {
+        hmac(u, 32, nullptr, 0, u);
+        for (int j = 0; j < 32; ++j) out[j] ^= u[j];
+    }
+}
+
+const string PASSWORD_SCHEME = "pbkdf2-sha256";
+
+string toHex(const unsigned char* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    string out;
+    out.reserve(len * 2);
+    for (size_t i = 0; i < len; ++i) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 15];
+    }
+    return out;
+}
+
+bool fromHex(const string &hex, string &out) {
+    if (hex.size() % 2) return false;
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        unsigned v = 0;
+        auto res = from_chars(hex.data() + i, hex.data() + i + 2, v, 16);
+        if (res.ptr != hex.data() + i + 2) return false;
+        out += (char)v;
+    }
+    return true;
+}
+
+bool constantTimeEquals(const unsigned char* a, const unsigned char* b, size_t len) {
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; ++i) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+string hashPassword(const string &password, uint32_t iterations) {
+    static thread_local mt19937_64 rng(random_device{}());
+    unsigned char salt[16];
+    for (size_t i = 0; i < sizeof(salt); i += 8) {
+        uint64_t r = rng();
+        memcpy(salt + i, &r, 8);
+    }
+    unsigned char key[32];
+    pbkdf2Sha256(password, string((char*)salt, sizeof(salt)), iterations, key);
+    return PASSWORD_SCHEME + "$" + to_string(iterations) + "$" + toHex(salt, sizeof(salt)) + "$" + toHex(key, 32);
+}
+
+bool parseCredential(const string &stored, StoredCredential &cred) {
+    if (stored.compare(0, PASSWORD_SCHEME.size() + 1, PASSWORD_SCHEME + "$") != 0) return false;
+    size_t a = PASSWORD_SCHEME.size() + 1;
+    size_t b = stored.find('$', a);
+    size_t c = b == string::npos ? b : stored.find('$', b + 1);
+    if (c == string::npos) return false;
+    auto res = from_chars(stored.data() + a, stored.data() + b, cred.iterations);
+    return res.ptr == stored.data() + b && cred.iterations > 0 &&
+           fromHex(stored.substr(b + 1, c - b - 1), cred.salt) &&
+           fromHex(stored.substr(c + 1), cred.key) && cred.key.size() == 32;
+}
+
+bool isHashedPassword(const string &stored) {
+    StoredCredential cred;
+    return parseCredential(stored, cred);
+}
+
+bool verifyPassword(const string &stored, const string &password) {
+    StoredCredential cred;
+    if (!parseCredential(stored, cred)) {
+        // legacy plaintext entry, compared as it always was (ignoring case)
+        // until the login that matches it re-hashes the password as typed.
+        // Both sides are padded to the longer length so that neither a
+        // length mismatch nor the first differing byte shows in the timing.
+        string a = toLowerCase(stored), b = toLowerCase(password);
+        size_t len = max(a.size(), b.size());
+        a.resize(len);
+        b.resize(len);
+        bool same = constantTimeEquals((const unsigned char*)a.data(), (const unsigned char*)b.data(), len);
+        return same && stored.size() == password.size();
+    }
+    unsigned char key[32];
+    pbkdf2Sha256(password, cred.salt, cred.iterations, key);
+    return constantTimeEquals(key, (const unsigned char*)cred.key.data(), 32);
+}
+
+uint32_t Sha256::rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+void Sha256::compress(const unsigned char* p) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+Sha256::Sha256() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, init, sizeof(state));
+}
+
+void Sha256::update(const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    length += len;
+    while (len > 0) {
+        size_t take = min(len, sizeof(block) - used);
+        memcpy(block + used, p, take);
+        used += take;
+        p += take;
+        len -= take;
+        if (used == sizeof(block)) {
+            compress(block);
+            used = 0;
+        }
+    }
+}
+
+void Sha256::finish(unsigned char out[32]) {
+    uint64_t bits = length * 8;
+    unsigned char pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used != 56) update(&pad, 1);
+    unsigned char len[8];
+    for (int i = 0; i < 8; ++i) len[i] = (unsigned char)(bits >> (56 - 8 * i));
+    update(len, 8);
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 4; ++j) out[4 * i + j] = (unsigned char)(state[i] >> (24 - 8 * j));
+    }
+}
+
+// ===== Search index =====
+vector<string> tokenize(string_view text) {
+    vector<string> tokens;
+    string current;
+    for (unsigned char c : text) {
+        if (isalnum(c)) {
+            current += (char)tolower(c);
+        } else if (!current.empty()) {
+            tokens.push_back(current);
+            current.clear();
+        }
+    }
+    if (!current.empty()) tokens.push_back(current);
+    return tokens;
+}
+
+int boundedEditDistance(string_view pattern, string_view text, int limit) {
+    int m = (int)pattern.size(), n = (int)text.size();
+    if (abs(m - n) > limit) return limit + 1;
+    if (m == 0) return n;
+    uint64_t peq[256] = {};
+    for (int i = 0; i < m; ++i) peq[(unsigned char)pattern[i]] |= 1ULL << i;
+    uint64_t pv = ~0ULL, mv = 0, d0 = 0, prevEq = 0, last = 1ULL << (m - 1);
+    int score = m;
+    for (int j = 0; j < n; ++j) {
+        uint64_t eq = peq[(unsigned char)text[j]];
+        uint64_t transposed = ((~d0 & eq) << 1) & prevEq;
+        d0 = (((eq & pv) + pv) ^ pv) | eq | mv | transposed;
+        uint64_t ph = mv | ~(d0 | pv);
+        uint64_t mh = d0 & pv;
+        if (ph & last) ++score;
+        else if (mh & last) --score;
+        if (score - (n - j - 1) > limit) return limit + 1;  // each remaining char lowers it by 1 at most
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(d0 | ph);
+        mv = ph & d0;
+        prevEq = eq;
+    }
+    return score <= limit ? score : limit + 1;
+}
+
+int typoBudget(size_t length) {
+    return length < 4 ? 0 : length < 8 ? 1 : 2;
+}
+
+vector<uint32_t> TrigramIndex::trigrams(string_view word) {
+    string padded = "\1" + string(word) + "\2";
+    vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+        grams.push_back((uint32_t)(unsigned char)padded[i] << 16 | (uint32_t)(unsigned char)padded[i + 1] << 8 |
+                        (unsigned char)padded[i + 2]);
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+void TrigramIndex::clear() {
+    words.clear();
+    freeSlots.clear();
+    slots.clear();
+    postings.clear();
+}
+
+void TrigramIndex::insert(const string &word) {
+    if (word.size() > 64 || slots.count(word)) return;
+    uint32_t slot;
+    if (freeSlots.empty()) {
+        slot = (uint32_t)words.size();
+        words.emplace_back();
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    vector<uint32_t> grams = trigrams(word);
+    words[slot] = {word, (uint8_t)grams.size(), true};
+    slots.emplace(word, slot);
+    for (uint32_t g : grams) postings[g].push_back(slot);
+}
+
+void TrigramIndex::erase(const string &word) {
+    auto it = slots.find(word);
+    if (it == slots.end()) return;
+    uint32_t slot = it->second;
+    for (uint32_t g : trigrams(word)) {
+        auto entry = postings.find(g);
+        if (entry == postings.end()) continue;
+        auto &list = entry->second;
+        auto pos = find(list.begin(), list.end(), slot);
+        if (pos != list.end()) {
+            *pos = list.back();
+            list.pop_back();
+        }
+        if (list.empty()) postings.erase(entry);
+    }
+    words[slot] = {};
+    freeSlots.push_back(slot);
+    slots.erase(it);
+}
+
+vector<TrigramIndex::Match> TrigramIndex::near(string_view query, int maxDistance) const {
+    vector<Match> matches;
+    if (maxDistance <= 0 || query.size() > 64) return matches;
+    vector<uint32_t> grams = trigrams(query);
+    // count shared trigrams per candidate, then keep those that can still
+    // be close enough: shared >= max(grams of either) - 4 * maxDistance
+    vector<uint8_t> shared(words.size());
+    vector<uint32_t> touched;
+    for (uint32_t g : grams) {
+        auto entry = postings.find(g);
+        if (entry == postings.end()) continue;
+        for (uint32_t slot : entry->second) {
+            if (shared[slot]++ == 0) touched.push_back(slot);
+        }
+    }
+    for (uint32_t slot : touched) {
+        const Word &w = words[slot];
+        int needed = (int)max<size_t>(grams.size(), w.grams) - 4 * maxDistance;
+        if (shared[slot] < needed || w.text == query) continue;
+        int distance = boundedEditDistance(query, w.text, maxDistance);
+        if (distance <= maxDistance) matches.push_back({w.text, distance});
+    }
+    return matches;
+}
+
+size_t TrigramIndex::size() const {
+    return slots.size();
+}
+
+bool SearchIndex::byId(const Posting &p, int id) {
+    return p.bookId < id;
+}
+
+void SearchIndex::addTokens(int id, string_view text, uint8_t field) {
+    for (auto &token : tokenize(text)) {
+        auto &list = postings[token];
+        if (list.empty()) vocabulary.insert(token);
+        auto it = lower_bound(list.begin(), list.end(), id, byId);
+        if (it != list.end() && it->bookId == id) it->fields |= field;
+        else list.insert(it, {id, field});
+    }
+}
+
+void SearchIndex::removeTokens(int id, string_view text) {
+    for (auto &token : tokenize(text)) {
+        auto entry = postings.find(token);
+        if (entry == postings.end()) continue;
+        auto &list = entry->second;
+        auto it = lower_bound(list.begin(), list.end(), id, byId);
+        if (it != list.end() && it->bookId == id) list.erase(it);
+        if (list.empty()) {
+            vocabulary.erase(token);
+            postings.erase(entry);
+        }
+    }
+}
+
+void SearchIndex::TermHits::add(const vector<Posting> &list, uint8_t fieldMask, int titleScore, int authorScore) {
+    for (const Posting &p : list) {
+        uint8_t fields = p.fields & fieldMask;
+        if (fields) hits.push_back({p.bookId, (fields & FIELD_TITLE) ? titleScore : authorScore});
+    }
+    ++tokens;
+}
+
+void SearchIndex::TermHits::finish() {
+    if (tokens < 2) return;  // a single posting list is already sorted and unique
+    sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+        return a.bookId != b.bookId ? a.bookId < b.bookId : a.score > b.score;
+    });
+    hits.erase(unique(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+        return a.bookId == b.bookId;
+    }), hits.end());
+}
+
+vector<SearchIndex::Hit> SearchIndex::intersect(const vector<TermHits> &terms) {
+    size_t smallest = 0;
+    for (size_t i = 1; i < terms.size(); ++i) {
+        if (terms[i].hits.size() < terms[smallest].hits.size()) smallest = i;
+    }
+    vector<Hit> hits;
+    vector<size_t> cursor(terms.size());
+    for (const Hit &candidate : terms[smallest].hits) {
+        int score = 0;
+        bool all = true;
+        for (size_t i = 0; i < terms.size() && all; ++i) {
+            const vector<Hit> &list = terms[i].hits;
+            auto it = lower_bound(list.begin() + cursor[i], list.end(), candidate.bookId,
+                                  [](const Hit &h, int id) { return h.bookId < id; });
+            cursor[i] = it - list.begin();
+            if (it == list.end() || it->bookId != candidate.bookId) all = false;
+            else score += it->score;
+        }
+        if (all) hits.push_back({candidate.bookId, score});
+    }
+    return hits;
+}
+
+bool SearchIndex::ranked(const Hit &a, const Hit &b) {
+    return a.score != b.score ? a.score > b.score : a.bookId < b.bookId;
+}
+
+void SearchIndex::clear() {
+    postings.clear();
+    vocabulary.clear();
+}
+
+void SearchIndex::add(int id, string_view title, string_view author) {
+    addTokens(id, title, FIELD_TITLE);
+    addTokens(id, author, FIELD_AUTHOR);
+}
+
+void SearchIndex::remove(int id, string_view title, string_view author) {
+    removeTokens(id, title);
+    removeTokens(id, author);
+}
+
+vector<SearchIndex::Hit> SearchIndex::query(const string &text, uint8_t fieldMask) const {
+    vector<string> terms = tokenize(text);
+    vector<Hit> hits;
+    if (terms.empty()) return hits;
+
+    // per term: the best score among the tokens each book matched
+    vector<TermHits> termHits(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const string &term = terms[i];
+        for (auto it = postings.lower_bound(term);
+             it != postings.end() && it->first.compare(0, term.size(), term) == 0; ++it) {
+            bool exact = it->first.size() == term.size();
+            termHits[i].add(it->second, fieldMask, exact ? 4 : 2, exact ? 3 : 1);
+        }
+        termHits[i].finish();
+        if (termHits[i].hits.empty()) return hits;
+    }
+
+    // intersect starting from the most selective term
+    hits = intersect(termHits);
+    sort(hits.begin(), hits.end(), ranked);
+    return hits;
+}
+
+vector<SearchIndex::Hit> SearchIndex::fuzzyQuery(const string &text, uint8_t fieldMask, size_t limit) const {
+    vector<string> terms = tokenize(text);
+    vector<Hit> hits;
+    if (terms.empty()) return hits;
+
+    vector<TermHits> termHits(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const string &term = terms[i];
+        for (auto it = postings.lower_bound(term);
+             it != postings.end() && it->first.compare(0, term.size(), term) == 0; ++it) {
+            bool exact = it->first.size() == term.size();
+            termHits[i].add(it->second, fieldMask, exact ? 12 : 6, exact ? 9 : 3);
+        }
+        for (auto &match : vocabulary.near(term, typoBudget(term.size()))) {
+            auto it = postings.find(string(match.word));
+            if (it != postings.end()) termHits[i].add(it->second, fieldMask, 6 - match.distance, 3 - match.distance);
+        }
+        termHits[i].finish();
+        if (termHits[i].hits.empty()) return hits;
+    }
+
+    hits = intersect(termHits);
+    size_t keep = min(limit, hits.size());
+    partial_sort(hits.begin(), hits.begin() + keep, hits.end(), ranked);
+    hits.resize(keep);
+    return hits;
+}
+
+// ===== Circulation analytics =====
+void CirculationStats::clear() {
+    byBook.clear();
+    byMonth.clear();
+    byMemberMonth.clear();
+    loans = returned = 0;
+    returnedDays = 0;
+    firstDay = INVALID_DAY;
+}
+
+void CirculationStats::recordIssue(int bookId, string_view member, int issueDay) {
+    BookStats &b = byBook[bookId];
+    ++b.loans;
+    ++b.open;
+    ++loans;
+    if (issueDay == INVALID_DAY) return;
+    b.openIssueDaySum += issueDay;
+    int month = monthOfDay(issueDay);
+    ++byMonth[month];
+    ++byMemberMonth[member][month];
+    if (firstDay == INVALID_DAY || issueDay < firstDay) firstDay = issueDay;
+}
+
+void CirculationStats::recordReturn(int bookId, int issueDay, int returnDay) {
+    BookStats &b = byBook[bookId];
+    if (b.open) --b.open;
+    ++returned;
+    if (issueDay == INVALID_DAY) return;
+    b.openIssueDaySum -= issueDay;
+    if (returnDay == INVALID_DAY) return;
+    b.closedDays += returnDay - issueDay;
+    returnedDays += returnDay - issueDay;
+}
+
+void CirculationStats::rebuild(const CowVector<Transaction> &history, const StringPool &names) {
+    clear();
+    byBook.reserve(history.size() / 4 + 1);
+    for (auto &t : history) recordIssue(t.bookId, names[t.memberId], t.issueDay);
+    for (auto &t : history) {
+        if (!t.open() && t.returnDay != INVALID_DAY) recordReturn(t.bookId, t.issueDay, t.returnDay);
+    }
+}
+
+size_t CirculationStats::totalLoans() const {
+    return loans;
+}
+
+size_t CirculationStats::returnedLoans() const {
+    return returned;
+}
+
+double CirculationStats::averageLoanDays() const {
+    return returned ? (double)returnedDays / returned : 0.0;
+}
+
+const map<int, size_t>& CirculationStats::loansByMonth() const {
+    return byMonth;
+}
+
+map<int, size_t> CirculationStats::memberMonths(string_view member) const {
+    auto it = byMemberMonth.find(member);
+    return it == byMemberMonth.end() ? map<int, size_t>() : it->second;
+}
+
+vector<CirculationStats::Ranked> CirculationStats::topBorrowed(size_t k) const {
+    vector<Ranked> all;
+    all.reserve(byBook.size());
+    for (auto &entry : byBook) all.push_back({entry.first, (double)entry.second.loans});
+    return topK(all, k);
+}
+
+vector<CirculationStats::Ranked> CirculationStats::topUtilization(size_t k, int asOfDay,
+                                                                  const function<int(int)> &copiesOf) const {
+    vector<Ranked> all;
+    if (firstDay == INVALID_DAY || asOfDay < firstDay) return all;
+    double window = asOfDay - firstDay + 1;
+    for (auto &entry : byBook) {
+        int copies = copiesOf(entry.first);
+        if (copies <= 0) continue;
+        const BookStats &b = entry.second;
+        double loanDays = b.closedDays + (double)b.open * asOfDay - b.openIssueDaySum;
+        all.push_back({entry.first, loanDays / (copies * window)});
+    }
+    return topK(all, k);
+}
+
+vector<CirculationStats::Ranked> CirculationStats::topK(vector<Ranked> &all, size_t k) {
+    k = min(k, all.size());
+    partial_sort(all.begin(), all.begin() + k, all.end(), [](const Ranked &a, const Ranked &b) {
+        return a.value != b.value ? a.value > b.value : a.bookId < b.bookId;
+    });
+    all.resize(k);
+    return all;
+}
+
+// ===== Hold queues =====
+bool HoldQueues::Entry::operator<(const Entry &o) const {
+    if (rank != o.rank) return rank < o.rank;
+    if (holdDay != o.holdDay) return holdDay < o.holdDay;
+    return seq < o.seq;
+}
+
+int HoldQueues::rankOf(string_view role) {
+    return (role == "admin" || role == "librarian") ? 0 : 1;
+}
+
+void HoldQueues::clear() {
+    byBook.clear();
+    byMember.clear();
+    nextSeq = 0;
+    count = 0;
+}
+
+bool HoldQueues::add(int bookId, string_view member, int rank, int holdDay) {
+    auto &mine = byMember[member];
+    if (mine.count(bookId)) return false;
+    Entry e = {rank, holdDay, nextSeq++, member};
+    mine.emplace(bookId, e);
+    byBook[bookId].insert(e);
+    ++count;
+    return true;
+}
+
+bool HoldQueues::remove(int bookId, string_view member) {
+    auto it = byMember.find(member);
+    if (it == byMember.end()) return false;
+    auto hold = it->second.find(bookId);
+    if (hold == it->second.end()) return false;
+    auto queue = byBook.find(bookId);
+    queue->second.erase(hold->second);
+    if (queue->second.empty()) byBook.erase(queue);
+    it->second.erase(hold);
+    if (it->second.empty()) byMember.erase(it);
+    --count;
+    return true;
+}
+
+bool HoldQueues::head(int bookId, Hold &out) const {
+    auto queue = byBook.find(bookId);
+    if (queue == byBook.end()) return false;
+    const Entry &first = *queue->second.begin();
+    out = {bookId, first.member, first.holdDay};
+    return true;
+}
+
+void HoldQueues::removeBook(int bookId) {
+    auto queue = byBook.find(bookId);
+    if (queue == byBook.end()) return;
+    vector<string_view> waiting;
+    for (auto &e : queue->second) waiting.push_back(e.member);
+    for (auto member : waiting) remove(bookId, member);
+}
+
+bool HoldQueues::has(int bookId, string_view member) const {
+    auto it = byMember.find(member);
+    return it != byMember.end() && it->second.count(bookId);
+}
+
+size_t HoldQueues::queued(int bookId) const {
+    auto queue = byBook.find(bookId);
+    return queue == byBook.end() ? 0 : queue->second.size();
+}
+
+size_t HoldQueues::position(int bookId, string_view member) const {
+    auto it = byMember.find(member);
+    if (it == byMember.end()) return 0;
+    auto hold = it->second.find(bookId);
+    if (hold == it->second.end()) return 0;
+    const set<Entry> &queue = byBook.at(bookId);
+    return (size_t)distance(queue.begin(), queue.find(hold->second)) + 1;
+}
+
+vector<HoldQueues::Hold> HoldQueues::ofMember(string_view member) const {
+    vector<Hold> out;
+    auto it = byMember.find(member);
+    if (it == byMember.end()) return out;
+    for (auto &entry : it->second) out.push_back({entry.first, entry.second.member, entry.second.holdDay});
+    return out;
+}
+
+vector<HoldQueues::Hold> HoldQueues::all() const {
+    vector<pair<uint64_t, Hold>> entries;
+    entries.reserve(count);
+    for (auto &queue : byBook) {
+        for (auto &e : queue.second) entries.push_back({e.seq, {queue.first, e.member, e.holdDay}});
+    }
+    sort(entries.begin(), entries.end(),
+         [](const pair<uint64_t, Hold> &a, const pair<uint64_t, Hold> &b) { return a.first < b.first; });
+    vector<Hold> out;
+    out.reserve(entries.size());
+    for (auto &e : entries) out.push_back(e.second);
+    return out;
+}
+
+size_t HoldQueues::size() const {
+    return count;
+}
+
+// ===== Copy inventory =====
+CopyTable::Copy& CopyTable::at(int32_t barcode) {
+    return copies.mutate(barcode - 1);
+}
+
+void CopyTable::shelve(Title &title, int32_t barcode) {
+    Copy &c = at(barcode);
+    c.status = SHELVED;
+    c.nextFree = title.freeHead;
+    title.freeHead = barcode;
+    ++title.available;
+}
+
+int32_t CopyTable::unshelve(int bookId, Status status) {
+    auto it = titles.find(bookId);
+    if (it == titles.end() || it->second.freeHead == NONE) return NONE;
+    Title &title = it->second;
+    int32_t barcode = title.freeHead;
+    Copy &c = at(barcode);
+    title.freeHead = c.nextFree;
+    c.nextFree = NONE;
+    c.status = status;
+    --title.available;
+    if (status == WITHDRAWN) --title.total;
+    return barcode;
+}
+
+const char* CopyTable::statusName(Status status) {
+    return status == SHELVED ? "shelved" : status == ON_LOAN ? "on-loan" : "withdrawn";
+}
+
+bool CopyTable::parseStatus(string_view text, Status &out) {
+    if (text == "shelved") out = SHELVED;
+    else if (text == "on-loan") out = ON_LOAN;
+    else if (text == "withdrawn") out = WITHDRAWN;
+    else return false;
+    return true;
+}
+
+void CopyTable::clear() {
+    copies.clear();
+    titles.clear();
+}
+
+int32_t CopyTable::add(int bookId, string_view location, Status status) {
+    copies.push_back({bookId, NONE, locations.intern(location), status});
+    int32_t barcode = (int32_t)copies.size();
+    Title &title = titles[bookId];
+    if (status != WITHDRAWN) ++title.total;
+    if (status == SHELVED) shelve(title, barcode);
+    return barcode;
+}
+
+int32_t CopyTable::take(int bookId) {
+    return unshelve(bookId, ON_LOAN);
+}
+
+int32_t CopyTable::withdraw(int bookId) {
+    return unshelve(bookId, WITHDRAWN);
+}
+
+bool CopyTable::release(int32_t barcode) {
+    if (barcode <= NONE || barcode > (int32_t)copies.size() || (*this)[barcode].status != ON_LOAN) return false;
+    shelve(titles[(*this)[barcode].bookId], barcode);
+    return true;
+}
+
+void CopyTable::reshelve() {
+    for (auto &entry : titles) {
+        entry.second.freeHead = NONE;
+        entry.second.available = 0;
+    }
+    for (int32_t barcode = 1; barcode <= (int32_t)copies.size(); ++barcode) {
+        if ((*this)[barcode].status == SHELVED) shelve(titles[(*this)[barcode].bookId], barcode);
+    }
+}
+
+void CopyTable::dropTitle(int bookId) {
+    titles.erase(bookId);
+}
+
+int CopyTable::total(int bookId) const {
+    auto it = titles.find(bookId);
+    return it == titles.end() ? 0 : it->second.total;
+}
+
+int CopyTable::available(int bookId) const {
+    auto it = titles.find(bookId);
+    return it == titles.end() ? 0 : it->second.available;
+}
+
+size_t CopyTable::size() const {
+    return copies.size();
+}
+
+const CopyTable::Copy& CopyTable::operator[](int32_t barcode) const {
+    return copies[barcode - 1];
+}
+
+string_view CopyTable::location(const Copy &c) const {
+    return locations[c.location];
+}
+
+CowVector<CopyTable::Copy> CopyTable::snapshot() const {
+    return copies.snapshot();
+}
+
+CowVector<string_view> CopyTable::locationSnapshot() const {
+    return locations.snapshot();
+}
+
+uint64_t CopyTable::version() const {
+    return copies.version();
+}
+
+// ===== Binary snapshot (library.snap) =====
+const SnapHeader& SnapshotReader::header() const {
+    return *reinterpret_cast<const SnapHeader*>(data);
+}
+
+bool SnapshotReader::tableFits(uint64_t offset, uint64_t count, size_t recordSize) const {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / recordSize;
+}
+
+SnapshotReader::~SnapshotReader() {
+#ifndef _WIN32
+    if (data) munmap(const_cast<char*>(data), size);
+#endif
+}
+
+bool SnapshotReader::open(const string &path, string &error) {
+#ifdef _WIN32
+    ifstream file(path, ios::binary);
+    if (!file) { error = "cannot open " + path; return false; }
+    buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { error = "cannot open " + path; return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        error = "cannot read " + path;
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) { error = "cannot map " + path; return false; }
+    data = static_cast<const char*>(mapped);
+    size = (size_t)st.st_size;
+#endif
+    if (size < sizeof(SnapHeader) || memcmp(header().magic, SNAPSHOT_MAGIC, 8) != 0) {
+        error = path + " is not a library snapshot";
+        return false;
+    }
+    const SnapHeader &h = header();
+    if (h.version != SNAPSHOT_VERSION || h.headerSize != sizeof(SnapHeader)) {
+        error = path + " has unsupported snapshot version " + to_string(h.version);
+        return false;
+    }
+    if (!tableFits(h.membersOffset, h.memberCount, sizeof(SnapMember)) ||
+        !tableFits(h.booksOffset, h.bookCount, sizeof(SnapBook)) ||
+        !tableFits(h.transactionsOffset, h.transactionCount, sizeof(SnapTransaction)) ||
+        h.poolOffset > size || h.poolSize > size - h.poolOffset) {
+        error = path + " is truncated or corrupt";
+        return false;
+    }
+    return true;
+}
+
+size_t SnapshotReader::memberCount() const {
+    return header().memberCount;
+}
+
+size_t SnapshotReader::bookCount() const {
+    return header().bookCount;
+}
+
+size_t SnapshotReader::transactionCount() const {
+    return header().transactionCount;
+}
+
+const SnapMember& SnapshotReader::memberAt(size_t i) const {
+    return reinterpret_cast<const SnapMember*>(data + header().membersOffset)[i];
+}
+
+const SnapBook& SnapshotReader::bookAt(size_t i) const {
+    return reinterpret_cast<const SnapBook*>(data + header().booksOffset)[i];
+}
+
+const SnapTransaction& SnapshotReader::transactionAt(size_t i) const {
+    return reinterpret_cast<const SnapTransaction*>(data + header().transactionsOffset)[i];
+}
+
+string_view SnapshotReader::str(const SnapString &s) const {
+    const SnapHeader &h = header();
+    if (s.offset > h.poolSize || s.length > h.poolSize - s.offset) return {};
+    return string_view(data + h.poolOffset + s.offset, s.length);
+}
+
+SnapString SnapshotWriter::add(string_view text) {
+    auto it = interned.find(text);
+    if (it != interned.end()) return it->second;
+    SnapString ref = {pool.size(), (uint32_t)text.size(), 0};
+    pool.append(text.data(), text.size());
+    interned.emplace(text, ref);
+    return ref;
+}
+
+bool SnapshotWriter::write(const string &path, const vector<SnapMember> &members, const vector<SnapBook> &books,
+                           const vector<SnapTransaction> &transactions) {
+    SnapHeader h = {};
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.version = SNAPSHOT_VERSION;
+    h.headerSize = sizeof(SnapHeader);
+    h.memberCount = members.size();
+    h.bookCount = books.size();
+    h.transactionCount = transactions.size();
+    h.membersOffset = sizeof(SnapHeader);
+    h.booksOffset = h.membersOffset + members.size() * sizeof(SnapMember);
+    h.transactionsOffset = h.booksOffset + books.size() * sizeof(SnapBook);
+    h.poolOffset = h.transactionsOffset + transactions.size() * sizeof(SnapTransaction);
+    h.poolSize = pool.size();
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(members.data()), members.size() * sizeof(SnapMember));
+    out.write(reinterpret_cast<const char*>(books.data()), books.size() * sizeof(SnapBook));
+    out.write(reinterpret_cast<const char*>(transactions.data()),
+              transactions.size() * sizeof(SnapTransaction));
+    out.write(pool.data(), pool.size());
+    out.close();
+    return !out.fail();
+}
+
+// ===== Durable writes =====
+bool syncPath(const string &path, bool directory) {
+#ifdef _WIN32
+    if (directory) return true;
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+    if (fd < 0) return false;
+    bool ok = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = ::open(path.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+#endif
+    return ok;
+}
+
+string parentDirectory(const string &path) {
+    string dir = filesystem::path(path).parent_path().string();
+    return dir.empty() ? "." : dir;
+}
+
+AppendOnlyFile::~AppendOnlyFile() {
+    close();
+}
+
+bool AppendOnlyFile::open(const string &path, bool truncate) {
+    close();
+#ifdef _WIN32
+    fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY | (truncate ? _O_TRUNC : 0),
+               _S_IREAD | _S_IWRITE);
+#else
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+#endif
+    return fd >= 0;
+}
+
+bool AppendOnlyFile::append(const string &data) {
+    size_t done = 0;
+    while (fd >= 0 && done < data.size()) {
+#ifdef _WIN32
+        int n = _write(fd, data.data() + done, (unsigned)(data.size() - done));
+#else
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return fd >= 0;
+}
+
+bool AppendOnlyFile::sync() {
+#ifdef _WIN32
+    return fd >= 0 && _commit(fd) == 0;
+#else
+    return fd >= 0 && fsync(fd) == 0;
+#endif
+}
+
+void AppendOnlyFile::close() {
+    if (fd < 0) return;
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+    fd = -1;
+}
+
+string FileCommit::shadowOf(const string &file) {
+    return file + ".new";
+}
+
+bool FileCommit::syncDirectories() const {
+    set<string> dirs;
+    for (auto &file : files) dirs.insert(parentDirectory(file));
+    string own = parentDirectory(manifest);
+    dirs.erase(own);
+    bool ok = true;
+    for (auto &dir : dirs) ok = syncPath(dir, true) && ok;
+    return syncPath(own, true) && ok;
+}
+
+FileCommit::FileCommit(const string &manifestPath) : manifest(manifestPath) {}
+
+string FileCommit::stage(const string &file) {
+    files.push_back(file);
+    return shadowOf(file);
+}
+
+bool FileCommit::prepare() {
+    for (auto &file : files) {
+        if (!syncPath(shadowOf(file))) return false;
+    }
+    if (!syncDirectories()) return false;
+    string tmp = manifest + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        for (auto &file : files) out << filesystem::path(file).filename().string() << "\n";
+        out.close();
+        if (out.fail()) return false;
+    }
+    if (!syncPath(tmp) || std::rename(tmp.c_str(), manifest.c_str()) != 0) return false;
+    return syncPath(parentDirectory(manifest), true);
+}
+
+bool FileCommit::install() {
+    bool ok = true;
+    for (auto &file : files) ok = std::rename(shadowOf(file).c_str(), file.c_str()) == 0 && ok;
+    return syncDirectories() && ok;
+}
+
+void FileCommit::finish() {
+    std::remove(manifest.c_str());
+    syncPath(parentDirectory(manifest), true);
+}
+
+void FileCommit::abort() {
+    std::remove(manifest.c_str());
+    std::remove((manifest + ".tmp").c_str());
+    for (auto &file : files) std::remove(shadowOf(file).c_str());
+}
+
+bool FileCommit::recover(const vector<string> &candidates) {
+    ifstream in(manifest);
+    if (!in) {
+        std::remove((manifest + ".tmp").c_str());
+        for (auto &file : candidates) std::remove(shadowOf(file).c_str());
+        return false;
+    }
+    string name;
+    while (getline(in, name)) {
+        for (auto &file : candidates) {
+            if (filesystem::path(file).filename().string() == name) files.push_back(file);
+        }
+    }
+    for (auto &file : files) {
+        if (ifstream(shadowOf(file)).good()) std::rename(shadowOf(file).c_str(), file.c_str());
+    }
+    syncDirectories();
+    return true;
+}
+
+// ===== Metrics =====
+#if LIBRARY_METRICS
+void LatencyHistogram::record(uint64_t nanos) {
+    uint64_t micros = (nanos + 999) / 1000;
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && (1ULL << bucket) < micros) ++bucket;
+    buckets[bucket].fetch_add(1, memory_order_relaxed);
+    calls.fetch_add(1, memory_order_relaxed);
+    totalNanos.fetch_add(nanos, memory_order_relaxed);
+    uint64_t seen = maxNanos.load(memory_order_relaxed);
+    while (nanos > seen && !maxNanos.compare_exchange_weak(seen, nanos, memory_order_relaxed)) {}
+}
+
+double LatencyHistogram::bound(int bucket) {
+    return bucket == BUCKETS - 1 ? numeric_limits<double>::infinity() : (double)(1ULL << bucket);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return calls.load(memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::inBucket(int bucket) const {
+    return buckets[bucket].load(memory_order_relaxed);
+}
+
+double LatencyHistogram::seconds() const {
+    return totalNanos.load(memory_order_relaxed) / 1e9;
+}
+
+double LatencyHistogram::maxMicros() const {
+    return maxNanos.load(memory_order_relaxed) / 1e3;
+}
+
+double LatencyHistogram::quantileMicros(double q) const {
+    uint64_t total = count(), seen = 0;
+    if (!total) return 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += inBucket(i);
+        if (seen >= q * total) return min(bound(i), maxMicros());
+    }
+    return maxMicros();
+}
+
+LatencyHistogram& Metrics::of(MetricOp op) {
+    static LatencyHistogram histograms[METRIC_OPS];
+    return histograms[op];
+}
+
+Metrics::Scope::Scope(MetricOp op) : op(op) {}
+
+Metrics::Scope::~Scope() {
+    auto nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    of(op).record((uint64_t)nanos);
+}
+#endif
+
+// ===== Loan archive =====
+void LoanArchive::putVarint(string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+bool LoanArchive::getVarint(string_view data, size_t &pos, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+        unsigned char byte = (unsigned char)data[pos++];
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+uint64_t LoanArchive::zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+int64_t LoanArchive::unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+uint64_t LoanArchive::checksum(string_view data) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool LoanArchive::before(const Segment &a, const Segment &b) {
+    return a.header.month != b.header.month ? a.header.month < b.header.month
+                                            : a.header.sequence < b.header.sequence;
+}
+
+shared_ptr<const vector<LoanRecord>> LoanArchive::load(const Segment &s) const {
+    lock_guard<mutex> lock(cacheMutex);
+    for (size_t i = 0; i < cache.size(); ++i) {
+        if (cache[i].first != s.path) continue;
+        rotate(cache.begin() + i, cache.begin() + i + 1, cache.end());
+        return cache.back().second;
+    }
+    METRIC_SCOPE(OP_LOAD_ARCHIVE);
+    auto loans = make_shared<vector<LoanRecord>>();
+    string data;
+    const ArchiveHeader &h = s.header;
+    if (readWholeFile(s.path, data) && data.size() == sizeof(ArchiveHeader) + h.payloadSize) {
+        string_view payload(data.data() + sizeof(ArchiveHeader), h.payloadSize);
+        if (checksum(payload) == h.checksum && !decode(payload, h.loanCount, *loans)) loans->clear();
+    }
+    cache.push_back({s.path, loans});
+    if (cache.size() > CACHED_SEGMENTS) cache.erase(cache.begin());
+    return loans;
+}
+
+bool LoanArchive::decode(string_view payload, uint64_t count, vector<LoanRecord> &out) const {
+    size_t pos = 0;
+    uint64_t nameCount, length;
+    if (!getVarint(payload, pos, nameCount) || nameCount > payload.size()) return false;
+    vector<string_view> members;
+    members.reserve(nameCount);
+    for (uint64_t i = 0; i < nameCount; ++i) {
+        if (!getVarint(payload, pos, length) || length > payload.size() - pos) return false;
+        members.push_back(names.view(payload.substr(pos, length)));
+        pos += length;
+    }
+    if (count > (payload.size() - pos) / 5) return false;  // every loan takes at least five bytes
+    out.reserve(count);
+    int64_t returnDay = 0, bookId = 0;
+    uint64_t f[5];
+    for (uint64_t i = 0; i < count; ++i) {
+        for (uint64_t &v : f) {
+            if (!getVarint(payload, pos, v)) return false;
+        }
+        if (f[4] >= members.size()) return false;
+        returnDay += unzigzag(f[0]);
+        bookId += unzigzag(f[2]);
+        out.push_back({(int32_t)bookId, (int32_t)unzigzag(f[3]), (int32_t)(returnDay - unzigzag(f[1])),
+                       (int32_t)returnDay, members[f[4]]});
+    }
+    return pos == payload.size();
+}
+
+string LoanArchive::open(const string &directory) {
+    dir = directory;
+    segments.clear();
+    cache.clear();
+    string skipped;
+    error_code ec;
+    for (auto &entry : filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().extension() != ".seg") continue;
+        Segment s = {entry.path().string(), {}, false};
+        ifstream file(s.path, ios::binary);
+        file.read(reinterpret_cast<char*>(&s.header), sizeof(ArchiveHeader));
+        const ArchiveHeader &h = s.header;
+        error_code sizeError;
+        if (!file || memcmp(h.magic, ARCHIVE_MAGIC, 8) != 0 || h.version != ARCHIVE_VERSION ||
+            h.headerSize != sizeof(ArchiveHeader) ||
+            filesystem::file_size(s.path, sizeError) != sizeof(ArchiveHeader) + h.payloadSize) {
+            skipped += (skipped.empty() ? "" : ", ") + entry.path().filename().string();
+            continue;
+        }
+        segments.push_back(s);
+    }
+    sort(segments.begin(), segments.end(), before);
+    return skipped.empty() ? "" : "skipped damaged archive segment(s) " + skipped;
+}
+
+vector<string> LoanArchive::pendingFiles(const string &directory) {
+    vector<string> files;
+    error_code ec;
+    for (auto &entry : filesystem::directory_iterator(directory, ec)) {
+        string path = entry.path().string();
+        if (path.size() > 8 && path.compare(path.size() - 8, 8, ".seg.new") == 0) {
+            files.push_back(path.substr(0, path.size() - 4));
+        }
+    }
+    return files;
+}
+
+string LoanArchive::nextPath(int month, int &sequence) const {
+    sequence = 1;
+    for (auto &s : segments) {
+        if (s.header.month == month) sequence = max(sequence, s.header.sequence + 1);
+    }
+    return dir + "/loans-" + monthLabel(month) + (sequence > 1 ? "." + to_string(sequence) : "") + ".seg";
+}
+
+bool LoanArchive::write(const string &path, int month, int sequence, const vector<LoanRecord> &loans,
+                        ArchiveHeader &h) {
+    METRIC_SCOPE(OP_SAVE_ARCHIVE);
+    h = {};
+    memcpy(h.magic, ARCHIVE_MAGIC, 8);
+    h.version = ARCHIVE_VERSION;
+    h.headerSize = sizeof(ArchiveHeader);
+    h.month = month;
+    h.sequence = sequence;
+    h.firstIssueDay = h.firstReturnDay = numeric_limits<int32_t>::max();
+    h.lastIssueDay = h.lastReturnDay = numeric_limits<int32_t>::min();
+    h.loanCount = loans.size();
+
+    unordered_map<string_view, uint32_t> nameIds;
+    string nameTable, rows;
+    int64_t returnDay = 0, bookId = 0;
+    for (auto &l : loans) {
+        auto id = nameIds.emplace(l.member, (uint32_t)nameIds.size());
+        if (id.second) {
+            putVarint(nameTable, l.member.size());
+            nameTable.append(l.member.data(), l.member.size());
+        }
+        putVarint(rows, zigzag(l.returnDay - returnDay));
+        putVarint(rows, zigzag((int64_t)l.returnDay - l.issueDay));
+        putVarint(rows, zigzag(l.bookId - bookId));
+        putVarint(rows, zigzag(l.copy));
+        putVarint(rows, id.first->second);
+        returnDay = l.returnDay;
+        bookId = l.bookId;
+        h.firstIssueDay = min(h.firstIssueDay, l.issueDay);
+        h.lastIssueDay = max(h.lastIssueDay, l.issueDay);
+        h.firstReturnDay = min(h.firstReturnDay, l.returnDay);
+        h.lastReturnDay = max(h.lastReturnDay, l.returnDay);
+    }
+    string payload;
+    putVarint(payload, nameIds.size());
+    payload += nameTable;
+    payload += rows;
+    h.payloadSize = payload.size();
+    h.checksum = checksum(payload);
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(payload.data(), payload.size());
+    out.close();
+    return !out.fail();
+}
+
+void LoanArchive::add(const string &path, const ArchiveHeader &header, bool counted) {
+    Segment s = {path, header, counted};
+    segments.insert(upper_bound(segments.begin(), segments.end(), s, before), s);
+}
+
+void LoanArchive::forEach(int fromDay, int toDay, bool byReturn, const function<void(const LoanRecord&)> &fn) const {
+    forEach(segments, fromDay, toDay, byReturn, fn);
+}
+
+void LoanArchive::forEach(const vector<Segment> &from, int fromDay, int toDay, bool byReturn,
+                          const function<void(const LoanRecord&)> &fn) const {
+    for (auto &s : from) {
+        int first = byReturn ? s.header.firstReturnDay : s.header.firstIssueDay;
+        int last = byReturn ? s.header.lastReturnDay : s.header.lastIssueDay;
+        if (last < fromDay || first > toDay) continue;
+        // held for the loop: another reader may evict it from the cache
+        shared_ptr<const vector<LoanRecord>> loans = load(s);
+        for (auto &l : *loans) {
+            int day = byReturn ? l.returnDay : l.issueDay;
+            if (day >= fromDay && day <= toDay) fn(l);
+        }
+    }
+}
+
+void LoanArchive::countNew(const function<void(const LoanRecord&)> &fn) {
+    for (auto &s : segments) {
+        if (s.counted) continue;
+        shared_ptr<const vector<LoanRecord>> loans = load(s);
+        for (auto &l : *loans) fn(l);
+        s.counted = true;
+    }
+}
+
+const vector<LoanArchive::Segment>& LoanArchive::all() const {
+    return segments;
+}
+
+size_t LoanArchive::loanCount() const {
+    size_t total = 0;
+    for (auto &s : segments) total += s.header.loanCount;
+    return total;
+}
+
+// ===== Bulk transfer files =====
+void BulkWriter::separate() {
+    if (json) {
+        buffer += field ? ",\"" : "{\"";
+        buffer += columns[field];
+        buffer += "\":";
+    } else if (field) {
+        buffer += ',';
+    }
+    ++field;
+}
+
+BulkWriter::BulkWriter(const string &path, const vector<string> &columnNames, BulkFormat format)
+    : file(path, ios::binary | ios::trunc), columns(columnNames), json(format == BulkFormat::JSON_LINES) {
+    if (json) return;
+    for (size_t i = 0; i < columns.size(); ++i) buffer += (i ? "," : "") + columns[i];
+    buffer += '\n';
+}
+
+BulkWriter& BulkWriter::text(string_view s) {
+    separate();
+    if (json) appendJsonString(buffer, s);
+    else buffer += csvField(s);
+    return *this;
+}
+
+BulkWriter& BulkWriter::number(long long n) {
+    separate();
+    char digits[24];
+    buffer.append(digits, to_chars(digits, digits + sizeof(digits), n).ptr);
+    return *this;
+}
+
+void BulkWriter::endRow() {
+    buffer += json ? "}\n" : "\n";
+    field = 0;
+    ++rows;
+    if (buffer.size() >= FLUSH_BYTES) {
+        file.write(buffer.data(), (streamsize)buffer.size());
+        buffer.clear();
+    }
+}
+
+bool BulkWriter::close() {
+    file.write(buffer.data(), (streamsize)buffer.size());
+    buffer.clear();
+    file.close();
+    return !file.fail();
+}
+
+size_t BulkWriter::rowCount() const {
+    return rows;
+}
+
+// ===== Operation results =====
+bool Result::ok() const {
+    return error == LibraryError::NONE;
+}
+
+// ===== Read views =====
+const pair<int, int>& LibraryView::countsOf(int id) const {
+    call_once(tallied, [this] {
+        for (auto &c : copyEntries) {
+            if (c.status == CopyTable::WITHDRAWN) continue;
+            pair<int, int> &n = counts[c.bookId];
+            if (c.status == CopyTable::SHELVED) ++n.first;
+            ++n.second;
+        }
+    });
+    static const pair<int, int> none(0, 0);
+    auto it = counts.find(id);
+    return it == counts.end() ? none : it->second;
+}
+
+vector<size_t> LibraryView::loanSlotsBetween(int fromDay, int toDay, DateField field) const {
+    auto range = field == BY_ISSUE_DATE
+        ? dayRange(issueOrder, fromDay, toDay, [this](size_t s) { return loanTable[s].issueDay; })
+        : dayRange(returnOrder, fromDay, toDay, [this](size_t s) { return loanTable[s].returnDay; });
+    return vector<size_t>(range.first, range.second);
+}
+
+LibraryView::LibraryView(CowVector<Book> books, CowVector<Member> members, CowVector<Transaction> loans,
+                         CowVector<CopyTable::Copy> copies, CowVector<string_view> names,
+                         CowVector<string_view> locations, CowVector<size_t> byIssueDay,
+                         CowVector<size_t> byReturnDay, vector<LoanArchive::Segment> archived, const LoanArchive &from)
+    : bookTable(move(books)), memberTable(move(members)), loanTable(move(loans)), copyEntries(move(copies)),
+      memberNames(move(names)), locationNames(move(locations)), issueOrder(move(byIssueDay)),
+      returnOrder(move(byReturnDay)), segments(move(archived)), archive(&from) {}
+
+const CowVector<Book>& LibraryView::books() const {
+    return bookTable;
+}
+
+const CowVector<Member>& LibraryView::members() const {
+    return memberTable;
+}
+
+const CowVector<Transaction>& LibraryView::transactions() const {
+    return loanTable;
+}
+
+string_view LibraryView::memberOf(const Transaction &t) const {
+    return memberNames[t.memberId];
+}
+
+int LibraryView::availableCopies(int id) const {
+    return countsOf(id).first;
+}
+
+int LibraryView::totalCopies(int id) const {
+    return countsOf(id).second;
+}
+
+size_t LibraryView::copyCount() const {
+    return copyEntries.size();
+}
+
+const CopyTable::Copy& LibraryView::copy(int32_t barcode) const {
+    return copyEntries[barcode - 1];
+}
+
+string_view LibraryView::location(const CopyTable::Copy &c) const {
+    return locationNames[c.location];
+}
+
+LoanRecord LibraryView::record(const Transaction &t) const {
+    return {t.bookId, t.copy, t.issueDay, t.returnDay, memberNames[t.memberId]};
+}
+
+TransactionView LibraryView::view(const LoanRecord &l) {
+    return {l.bookId, l.copy, l.member, dayLabel(l.issueDay), dayLabel(l.returnDay)};
+}
+
+vector<LoanRecord> LibraryView::loanHistory(int fromDay, int toDay, DateField field) const {
+    vector<LoanRecord> loans;
+    archive->forEach(segments, fromDay, toDay, field == BY_RETURN_DATE,
+                     [&](const LoanRecord &l) { loans.push_back(l); });
+    stable_sort(loans.begin(), loans.end(),
+                [](const LoanRecord &a, const LoanRecord &b) { return a.issueDay < b.issueDay; });
+    vector<size_t> slots = loanSlotsBetween(fromDay, toDay, field);
+    sort(slots.begin(), slots.end());
+    for (size_t slot : slots) loans.push_back(record(loanTable[slot]));
+    return loans;
+}
+
+vector<TransactionView> LibraryView::loansBetween(int fromDay, int toDay, DateField field) const {
+    vector<LoanRecord> archived;
+    archive->forEach(segments, fromDay, toDay, field == BY_RETURN_DATE,
+                     [&](const LoanRecord &l) { archived.push_back(l); });
+    auto dayOf = [field](const LoanRecord &l) { return field == BY_ISSUE_DATE ? l.issueDay : l.returnDay; };
+    stable_sort(archived.begin(), archived.end(),
+                [&](const LoanRecord &a, const LoanRecord &b) { return dayOf(a) < dayOf(b); });
+    vector<TransactionView> loans;
+    auto next = archived.begin();
+    for (size_t slot : loanSlotsBetween(fromDay, toDay, field)) {
+        LoanRecord live = record(loanTable[slot]);
+        for (; next != archived.end() && dayOf(*next) <= dayOf(live); ++next) loans.push_back(view(*next));
+        loans.push_back(view(live));
+    }
+    for (; next != archived.end(); ++next) loans.push_back(view(*next));
+    return loans;
+}
+
+// ===== Library class =====
+// ---- Index maintenance ----
+void Library::reindexBooksFrom(size_t from) {
+    for (size_t i = from; i < books.size(); ++i) {
+        bookIndex[books[i].id] = i;
+    }
+}
+
+int Library::dueDayOf(const Transaction &t) {
+    return t.issueDay == INVALID_DAY ? INVALID_DAY : t.issueDay + LOAN_PERIOD_DAYS;
+}
+
+void Library::indexOpenLoan(size_t slot) {
+    const Transaction &t = transactions[slot];
+    openLoansByMember[names[t.memberId]].push_back(slot);
+    openLoansByBook[t.bookId].push_back(slot);
+    int due = dueDayOf(t);
+    if (due != INVALID_DAY) openLoansByDueDay[due].push_back(slot);
+}
+
+void Library::unindexOpenLoan(size_t slot) {
+    const Transaction &t = transactions[slot];
+    dropLoanSlot(openLoansByMember, names[t.memberId], slot);
+    dropLoanSlot(openLoansByBook, t.bookId, slot);
+    int due = dueDayOf(t);
+    if (due != INVALID_DAY) dropLoanSlot(openLoansByDueDay, due, slot);
+}
+
+void Library::rebuildOpenLoans() {
+    openLoansByMember.clear();
+    openLoansByBook.clear();
+    openLoansByDueDay.clear();
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        if (transactions[i].open()) indexOpenLoan(i);
+    }
+}
+
+size_t Library::openLoanSlot(int id, const string &member) const {
+    auto byMember = openLoansByMember.find(member);
+    auto byBook = openLoansByBook.find(id);
+    if (byMember == openLoansByMember.end() || byBook == openLoansByBook.end()) return transactions.size();
+    // walk whichever list is shorter; both are in issue order
+    bool useMember = byMember->second.size() <= byBook->second.size();
+    for (size_t slot : useMember ? byMember->second : byBook->second) {
+        const Transaction &loan = transactions[slot];
+        if (loan.bookId == id && equalsIgnoreCase(names[loan.memberId], member)) return slot;
+    }
+    return transactions.size();
+}
+
+int Library::issueDayAt(size_t slot) const {
+    return transactions[slot].issueDay;
+}
+
+int Library::returnDayAt(size_t slot) const {
+    return transactions[slot].returnDay;
+}
+
+void Library::indexIssueDay(size_t slot) {
+    insertByDay(loansByIssueDay, slot, [this](size_t s) { return issueDayAt(s); });
+}
+
+void Library::indexReturnDay(size_t slot) {
+    if (returnDayAt(slot) == INVALID_DAY) return;
+    insertByDay(loansByReturnDay, slot, [this](size_t s) { return returnDayAt(s); });
+}
+
+void Library::rebuildDateIndexes() {
+    vector<size_t> byIssue, byReturn;
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        byIssue.push_back(i);
+        if (!transactions[i].open() && transactions[i].returnDay != INVALID_DAY) byReturn.push_back(i);
+    }
+    stable_sort(byIssue.begin(), byIssue.end(),
+                [this](size_t a, size_t b) { return issueDayAt(a) < issueDayAt(b); });
+    stable_sort(byReturn.begin(), byReturn.end(),
+                [this](size_t a, size_t b) { return returnDayAt(a) < returnDayAt(b); });
+    loansByIssueDay.assign(byIssue);
+    loansByReturnDay.assign(byReturn);
+}
+
+void Library::rebuildSearchIndex() {
+    searchIndex.clear();
+    for (auto &b : books) searchIndex.add(b.id, b.title, b.author);
+}
+
+const Book* Library::findBook(int id) const {
+    auto it = bookIndex.find(id);
+    return it == bookIndex.end() ? nullptr : &books[it->second];
+}
+
+// ---- State mutations (shared by the interactive ops and journal replay) ----
+bool Library::applyAddMember(const string &name, const string &pass, const string &role) {
+    if (getMember(name)) return false;
+    members.push_back({names.view(name), pass, role});
+    memberIndex.emplace(members.back().name, members.size() - 1);
+    noteCredential(pass);
+    return true;
+}
+
+bool Library::applySetPassword(const string &name, const string &hash) {
+    auto it = memberIndex.find(name);
+    if (it == memberIndex.end()) return false;
+    members.mutate(it->second).password = hash;
+    noteCredential(hash);
+    return true;
+}
+
+void Library::noteCredential(const string &stored) {
+    StoredCredential cred;
+    if (parseCredential(stored, cred)) storedIterations = max(storedIterations, cred.iterations);
+}
+
+bool Library::applyAddBook(int id, const string &title, const string &author, int count, const string &location) {
+    if (findBook(id) || count <= 0) return false;
+    bookIndex.emplace(id, books.size());
+    books.push_back({id, titles.add(title), authors.view(author)});
+    searchIndex.add(id, title, author);
+    for (int i = 0; i < count; ++i) copies.add(id, location.empty() ? DEFAULT_LOCATION : location);
+    return true;
+}
+
+bool Library::applyUpdateBook(int id, const string &title, const string &author, int total) {
+    auto idx = bookIndex.find(id);
+    if (idx == bookIndex.end()) return false;
+    int issuedCopies = copies.total(id) - copies.available(id);
+    if (total < issuedCopies) return false;
+    Book &b = books.mutate(idx->second);
+    searchIndex.remove(id, b.title, b.author);
+    searchIndex.add(id, title, author);
+    if (b.title != title) b.title = titles.add(title);
+    b.author = authors.view(author);
+    while (copies.total(id) < total) copies.add(id, DEFAULT_LOCATION);
+    while (copies.total(id) > total) copies.withdraw(id);
+    return true;
+}
+
+bool Library::applyDeleteCopies(int id, int count) {
+    auto idx = bookIndex.find(id);
+    if (idx == bookIndex.end()) return false;
+    size_t slot = idx->second;
+    const Book &b = books[slot];
+    if (count <= 0 || count > copies.available(id)) return false;
+    for (int i = 0; i < count; ++i) copies.withdraw(id);
+    if (copies.total(id) == 0) {
+        searchIndex.remove(id, b.title, b.author);
+        holds.removeBook(id);
+        copies.dropTitle(id);
+        books.erase(slot);
+        bookIndex.erase(idx);
+        reindexBooksFrom(slot);
+    }
+    return true;
+}
+
+bool Library::applyIssue(int id, const string &member, const string &date) {
+    if (!findBook(id)) return false;
+    int32_t copy = copies.take(id);
+    if (copy == CopyTable::NONE) return false;
+    uint32_t memberId = names.intern(member);
+    transactions.push_back({id, memberId, parseDay(date), OPEN_LOAN, copy});
+    indexOpenLoan(transactions.size() - 1);
+    indexIssueDay(transactions.size() - 1);
+    stats.recordIssue(id, names[memberId], transactions.back().issueDay);
+    holds.remove(id, member);  // a hold is used up by the loan it was waiting for
+    return true;
+}
+
+bool Library::applyPlaceHold(int id, const string &member, const string &date) {
+    const Member* m = getMember(member);
+    if (!m || !findBook(id)) return false;
+    return holds.add(id, m->name, HoldQueues::rankOf(m->role), parseDay(date));
+}
+
+const Transaction* Library::applyReturn(int id, const string &member, const string &date, string* servedHold) {
+    if (!findBook(id)) return nullptr;
+    size_t slot = openLoanSlot(id, member);
+    if (slot == transactions.size()) return nullptr;
+    unindexOpenLoan(slot);
+    Transaction &t = transactions.mutate(slot);
+    t.returnDay = parseDay(date);
+    indexReturnDay(slot);
+    copies.release(t.copy);
+    stats.recordReturn(id, t.issueDay, t.returnDay);
+    HoldQueues::Hold next;
+    if (holds.head(id, next)) {
+        string holder(next.member);
+        applyIssue(id, holder, date);
+        if (servedHold) *servedHold = holder;
+    }
+    return &transactions[slot];
+}
+
+// ---- Journal ----
+void Library::openJournal(bool truncate) {
+    // a group-commit leader may still be syncing the old handle
+    unique_lock<mutex> lock(syncMutex);
+    journalSynced.wait(lock, [this] { return !syncing; });
+    journal.open(journalFile, truncate);
+    if (truncate) {
+        journal.sync();
+        journalTorn = false;
+    }
+    // anything appended before this point is in the committed snapshot
+    durableRecords = appendedRecords;
+}
+
+void Library::applyJournalRecord(const vector<string> &f) {
+    const string &op = f[0];
+    if (op == "ADD_MEMBER" && f.size() == 4) {
+        applyAddMember(f[1], f[2], f[3]);
+    } else if (op == "SET_PASSWORD" && f.size() == 3) {
+        applySetPassword(f[1], f[2]);
+    } else if (op == "ADD_BOOK" && (f.size() == 5 || f.size() == 6)) {
+        applyAddBook(atoi(f[1].c_str()), f[2], f[3], atoi(f[4].c_str()), f.size() == 6 ? f[5] : "");
+    } else if (op == "UPDATE_BOOK" && f.size() == 5) {
+        applyUpdateBook(atoi(f[1].c_str()), f[2], f[3], atoi(f[4].c_str()));
+    } else if (op == "DELETE_COPIES" && f.size() == 3) {
+        applyDeleteCopies(atoi(f[1].c_str()), atoi(f[2].c_str()));
+    } else if (op == "ISSUE" && f.size() == 4) {
+        applyIssue(atoi(f[1].c_str()), f[2], f[3]);
+    } else if (op == "RETURN" && f.size() == 4) {
+        applyReturn(atoi(f[1].c_str()), f[2], f[3]);
+    } else if (op == "HOLD" && f.size() == 4) {
+        applyPlaceHold(atoi(f[1].c_str()), f[2], f[3]);
+    } else if (op == "CANCEL_HOLD" && f.size() == 3) {
+        holds.remove(atoi(f[1].c_str()), f[2]);
+    }
+}
+
+void Library::replayJournal() {
+    journalRecords = 0;
+    bool tornTail = false;
+    ifstream file(journalFile, ios::binary);
+    if (file) {
+        string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        size_t pos = 0, nl;
+        while ((nl = data.find('\n', pos)) != string::npos) {
+            applyJournalRecord(splitRecord(data.substr(pos, nl - pos)));
+            ++journalRecords;
+            pos = nl + 1;
+        }
+        // a record without its newline was cut off mid-append; it is discarded
+        tornTail = pos < data.size();
+    }
+    if (tornTail || !journalMode || journalRecords >= compactThreshold) {
+        compact();
+    } else {
+        openJournal(false);
+    }
+}
+
+bool Library::persist(const vector<string> &record, int dirty) {
+    if (deferPersist) return true;
+    METRIC_SCOPE(OP_PERSIST);
+    // records appended now would be truncated when the stranded commit is
+    // rolled forward, so nothing more is saved until the next start
+    if (commitStranded) return false;
+    if (!journalMode) return commitFiles(dirty);
+    // a partly written record would swallow the next one on replay, so
+    // after a failed append the change goes out with the whole snapshot
+    if (journalTorn || !journal.append(makeRecord(record) + '\n')) {
+        journalTorn = true;
+        return compact();
+    }
+    uint64_t seq = ++appendedRecords;
+    if (++journalRecords >= compactThreshold) compact();
+    return groupCommit || waitDurable(seq);
+}
+
+// ---- Archiving ----
+vector<size_t> Library::archivableLoans() const {
+    if (archiveHorizon <= 0) return {};
+    int y, m, d;
+    civilFromDays(parseDay(currentDate()) - archiveHorizon, y, m, d);
+    auto range = dayRange(loansByReturnDay, numeric_limits<int>::min(), daysFromCivil(y, m, 1) - 1,
+                          [this](size_t s) { return returnDayAt(s); });
+    vector<size_t> slots(range.first, range.second);
+    sort(slots.begin(), slots.end());
+    return slots;
+}
+
+bool Library::stageArchive(const vector<size_t> &slots, FileCommit &commit, vector<StagedSegment> &staged) {
+    if (slots.empty()) return true;
+    map<int, vector<LoanRecord>> byMonth;
+    for (size_t slot : slots) byMonth[monthOfDay(returnDayAt(slot))].push_back(record(transactions[slot]));
+    error_code ec;
+    filesystem::create_directories(archiveDir, ec);
+    for (auto &month : byMonth) {
+        StagedSegment s;
+        int sequence;
+        s.path = archive.nextPath(month.first, sequence);
+        if (!LoanArchive::write(commit.stage(s.path), month.first, sequence, month.second, s.header)) return false;
+        staged.push_back(s);
+    }
+    return true;
+}
+
+void Library::dropArchivedLoans(const vector<bool> &archived) {
+    vector<Transaction> kept;
+    kept.reserve(transactions.size());
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        if (!archived[i]) kept.push_back(transactions[i]);
+    }
+    transactions.assign(kept);
+    rebuildOpenLoans();
+    rebuildDateIndexes();
+}
+
+bool Library::commitFiles(int dirty) {
+    METRIC_SCOPE(OP_COMMIT);
+    if (commitStranded) return false;
+    FileCommit commit(manifestFile);
+    vector<size_t> archiving = archivableLoans();
+    vector<bool> archived(transactions.size());
+    for (size_t slot : archiving) archived[slot] = true;
+    if (!archiving.empty()) dirty |= DIRTY_TRANSACTIONS;
+    vector<StagedSegment> staged;
+    bool written = stageArchive(archiving, commit, staged) && (binarySnapshot
+        ? saveSnapshot(commit.stage(snapshotFile), archived)
+        : (!(dirty & DIRTY_MEMBERS) || saveMembers(commit.stage(membersFile))) &&
+          (!(dirty & DIRTY_BOOKS) || saveBooks(commit.stage(booksFile))) &&
+          (!(dirty & DIRTY_TRANSACTIONS) || saveTransactions(commit.stage(transactionsFile), archived)));
+    // holds and copies are not part of library.snap and always live in text files
+    written = written && (!(dirty & DIRTY_HOLDS) || saveHolds(commit.stage(holdsFile))) &&
+              (!(dirty & DIRTY_BOOKS) || saveCopies(commit.stage(copiesFile)));
+    if (!written || !commit.prepare()) {
+        commit.abort();
+        return false;
+    }
+    // the manifest is on disk, so the files are committed even if some are
+    // not in place yet; recover() finishes the renames on the next start
+    if (!commit.install()) {
+        commitStranded = true;
+        return false;
+    }
+    if (dirty & DIRTY_BOOKS) copies.reshelve();  // the journal replays against copies.txt from here on
+    if (!archiving.empty()) {
+        // these loans are already in the stats
+        for (auto &s : staged) archive.add(s.path, s.header, true);
+        dropArchivedLoans(archived);
+    }
+    openJournal(true);
+    commit.finish();
+    return true;
+}
+
+// ---- Bulk transfer ----
+string Library::readBulkTable(const string &dir, const string &table, const vector<string> &columns, size_t required,
+                              string &buffer, vector<string> &problems,
+                              const function<string(size_t, const vector<string_view>&)> &row) {
+    string file = table + ".csv";
+    bool json = false;
+    if (!readWholeFile(dir + "/" + file, buffer)) {
+        file = table + ".jsonl";
+        json = true;
+        if (!readWholeFile(dir + "/" + file, buffer)) return "";
+    }
+    BulkCursor at;
+    vector<string_view> values(columns.size());
+    auto take = [&]() {
+        string message = row(at.recordLine, values);
+        if (!message.empty()) problems.push_back(file + ":" + to_string(at.recordLine) + ": " + message);
+    };
+    if (json) {
+        vector<pair<string_view, string_view>> fields;
+        bool malformed;
+        while (parseJsonObject(buffer, at, fields, malformed)) {
+            if (malformed) {
+                problems.push_back(file + ":" + to_string(at.recordLine) + ": not a flat JSON object");
+                continue;
+            }
+            fill(values.begin(), values.end(), string_view());
+            for (auto &f : fields) {
+                for (size_t c = 0; c < columns.size(); ++c) {
+                    if (f.first == columns[c]) values[c] = f.second;
+                }
+            }
+            take();
+        }
+        return file;
+    }
+    // the header row names the columns, in any order
+    vector<string_view> fields;
+    vector<size_t> position(columns.size(), SIZE_MAX);
+    if (parseCsvLine(buffer, at, fields)) {
+        for (size_t f = 0; f < fields.size(); ++f) {
+            for (size_t c = 0; c < columns.size(); ++c) {
+                if (fields[f] == columns[c]) position[c] = f;
+            }
+        }
+    }
+    for (size_t c = 0; c < required; ++c) {
+        if (position[c] == SIZE_MAX) {
+            problems.push_back(file + ":1: missing column '" + columns[c] + "'");
+            return file;
+        }
+    }
+    while (parseCsvLine(buffer, at, fields)) {
+        for (size_t c = 0; c < columns.size(); ++c) {
+            values[c] = position[c] < fields.size() ? fields[position[c]] : string_view();
+        }
+        take();
+    }
+    return file;
+}
+
+Library::Library(bool journaled, size_t compactEvery, const string &dataDir)
+    : journalMode(journaled), compactThreshold(compactEvery ? compactEvery : 1) {
+    if (!dataDir.empty()) {
+        for (string* file : {&membersFile, &booksFile, &transactionsFile, &holdsFile, &copiesFile,
+                             &journalFile, &snapshotFile, &manifestFile, &archiveDir}) {
+            *file = dataDir + "/" + *file;
+        }
+    }
+    FileCommit interrupted(manifestFile);
+    vector<string> committed = {membersFile, booksFile, transactionsFile, holdsFile, copiesFile, snapshotFile};
+    for (auto &segment : LoanArchive::pendingFiles(archiveDir)) committed.push_back(segment);
+    if (interrupted.recover(committed)) {
+        // the rolled-forward files already hold everything in the journal
+        openJournal(true);
+        interrupted.finish();
+    }
+    copiesLoaded = loadCopies();
+    if (!loadSnapshot()) loadTextFiles();
+    for (size_t i = 0; i < members.size(); ++i) noteCredential(members[i].password);
+    loadHolds();
+    string skipped = archive.open(archiveDir);
+    if (!skipped.empty()) loadWarning += (loadWarning.empty() ? "" : "; ") + skipped;
+    // the derived indexes only read the loaded data and are independent of each other
+    thread openLoanIndexer([this] { rebuildOpenLoans(); });
+    thread dateIndexer([this] { rebuildDateIndexes(); });
+    thread searchIndexer([this] { rebuildSearchIndex(); });
+    stats.rebuild(transactions, names);
+    openLoanIndexer.join();
+    dateIndexer.join();
+    searchIndexer.join();
+    replayJournal();
+}
+
+bool Library::compact() {
+    if (!commitFiles(DIRTY_ALL)) return false;
+    journalRecords = 0;
+    return true;
+}
+
+bool Library::flush() {
+    return journalRecords == 0 || compact();
+}
+
+void Library::setDeferPersist(bool deferred) {
+    deferPersist = deferred;
+}
+
+const string& Library::warning() const {
+    return loadWarning;
+}
+
+// ---- Archive ----
+void Library::setArchiveHorizon(int days) {
+    archiveHorizon = max(days, 0);
+}
+
+size_t Library::archiveClosedLoans() {
+    size_t before = transactions.size();
+    if (archivableLoans().empty() || !compact()) return 0;
+    return before - transactions.size();
+}
+
+const vector<LoanArchive::Segment>& Library::archiveSegments() const {
+    return archive.all();
+}
+
+size_t Library::archivedLoanCount() const {
+    return archive.loanCount();
+}
+
+// ---- Group commit ----
+void Library::setGroupCommit(bool enabled) {
+    groupCommit = enabled;
+}
+
+uint64_t Library::journalSequence() const {
+    return appendedRecords;
+}
+
+bool Library::waitDurable(uint64_t seq) {
+    unique_lock<mutex> lock(syncMutex);
+    while (durableRecords < seq) {
+        if (failedRecords >= seq) return false;
+        if (syncing) {
+            journalSynced.wait(lock);
+            continue;
+        }
+        syncing = true;
+        uint64_t target = appendedRecords;
+        lock.unlock();
+        bool synced = journal.sync();
+        lock.lock();
+        syncing = false;
+        if (synced) durableRecords = max(durableRecords, target);
+        else failedRecords = max(failedRecords, target);
+        journalSynced.notify_all();
+    }
+    return true;
+}
+
+bool Library::convertToSnapshot() {
+    binarySnapshot = true;
+    return compact();
+}
+
+bool Library::convertToText() {
+    binarySnapshot = false;
+    if (!compact()) return false;
+    std::remove(snapshotFile.c_str());
+    return true;
+}
+
+// ---- Operations ----
+Result Library::addBook(int id, const string &title, const string &author, int count, const string &location) {
+    if (title.empty() || author.empty()) {
+        return failure(LibraryError::INVALID_INPUT, "title and author are required");
+    }
+    if (count <= 0) return failure(LibraryError::INVALID_INPUT, "copies must be at least 1");
+    if (!applyAddBook(id, title, author, count, location)) {
+        return failure(LibraryError::BOOK_EXISTS, "book ID " + to_string(id) + " already exists");
+    }
+    vector<string> record = {"ADD_BOOK", to_string(id), title, author, to_string(count)};
+    if (!location.empty()) record.push_back(location);
+    return persisted(record, DIRTY_BOOKS);
+}
+
+Result Library::updateBook(int id, const string &title, const string &author, int total) {
+    const Book* b = getBook(id);
+    if (!b) return failure(LibraryError::BOOK_NOT_FOUND, "book " + to_string(id) + " not found");
+    string newTitle = title.empty() ? string(b->title) : title;
+    string newAuthor = author.empty() ? string(b->author) : author;
+    if (total < 0) total = copies.total(id);
+    int issuedCopies = copies.total(id) - copies.available(id);
+    if (total < issuedCopies) {
+        return failure(LibraryError::COPIES_ON_LOAN,
+                       "cannot set total copies less than issued copies (" + to_string(issuedCopies) + ")");
+    }
+    applyUpdateBook(id, newTitle, newAuthor, total);
+    return persisted({"UPDATE_BOOK", to_string(id), newTitle, newAuthor, to_string(total)}, DIRTY_BOOKS);
+}
+
+DeleteResult Library::deleteCopies(int id, int count) {
+    if (!getBook(id)) {
+        return failure<DeleteResult>(LibraryError::BOOK_NOT_FOUND, "book " + to_string(id) + " not found");
+    }
+    if (count <= 0) {
+        return failure<DeleteResult>(LibraryError::INVALID_INPUT, "copies to delete must be at least 1");
+    }
+    int available = copies.available(id);
+    if (count > available) {
+        return failure<DeleteResult>(LibraryError::COPIES_ON_LOAN,
+                                     "only " + to_string(available) + " copies are available to delete");
+    }
+    DeleteResult r;
+    r.remaining = copies.total(id) - count;
+    applyDeleteCopies(id, count);
+    return persisted({"DELETE_COPIES", to_string(id), to_string(count)}, DIRTY_BOOKS, r);
+}
+
+Result Library::addMember(const string &name, const string &pass, const string &roleText) {
+    string role = toLowerCase(roleText);
+    if (name.empty() || pass.empty()) return failure(LibraryError::INVALID_INPUT, "name and password are required");
+    if (role != "admin" && role != "librarian" && role != "member") {
+        return failure(LibraryError::INVALID_INPUT, "invalid role '" + roleText + "'");
+    }
+    if (getMember(name)) return failure(LibraryError::MEMBER_EXISTS, "username '" + name + "' already exists");
+    string hash = hashPassword(pass, kdfIterations);
+    applyAddMember(name, hash, role);
+    return persisted({"ADD_MEMBER", name, hash, role}, DIRTY_MEMBERS);
+}
+
+IssueResult Library::issueBook(int id, const string &member, const string &date) {
+    METRIC_SCOPE(OP_ISSUE);
+    if (!isDateString(date)) return failure<IssueResult>(LibraryError::INVALID_INPUT, "date must be YYYY-MM-DD");
+    if (!findBook(id)) {
+        return failure<IssueResult>(LibraryError::BOOK_NOT_FOUND, "book " + to_string(id) + " not found");
+    }
+    if (copies.available(id) <= 0) {
+        return failure<IssueResult>(LibraryError::NO_COPY_AVAILABLE,
+                                    "no copies of book " + to_string(id) + " available");
+    }
+    if (!getMember(member)) {
+        return failure<IssueResult>(LibraryError::MEMBER_NOT_FOUND, "member '" + member + "' not found");
+    }
+    string holder = holdHead(id);
+    if (!holder.empty() && !equalsIgnoreCase(holder, member)) {
+        return failure<IssueResult>(LibraryError::RESERVED,
+                                    "book " + to_string(id) + " is reserved for '" + holder + "' (hold queue)");
+    }
+    applyIssue(id, member, date);
+    IssueResult r;
+    r.copy = transactions.back().copy;
+    return persisted({"ISSUE", to_string(id), member, date}, DIRTY_BOOKS | DIRTY_TRANSACTIONS | DIRTY_HOLDS, r);
+}
+
+ReturnResult Library::returnBook(int id, const string &member, const string &date) {
+    METRIC_SCOPE(OP_RETURN);
+    if (!isDateString(date)) return failure<ReturnResult>(LibraryError::INVALID_INPUT, "date must be YYYY-MM-DD");
+    if (!findBook(id)) {
+        return failure<ReturnResult>(LibraryError::BOOK_NOT_FOUND, "book " + to_string(id) + " not found");
+    }
+    size_t slot = openLoanSlot(id, member);
+    if (slot < transactions.size() && parseDay(date) < transactions[slot].issueDay) {
+        return failure<ReturnResult>(LibraryError::INVALID_INPUT,
+                                     "return date is before the issue date " + dayLabel(transactions[slot].issueDay));
+    }
+    ReturnResult r;
+    const Transaction* t = applyReturn(id, member, date, &r.servedHold);
+    if (!t) {
+        return failure<ReturnResult>(LibraryError::NOT_ON_LOAN,
+                                     "no outstanding issue of book " + to_string(id) + " to '" + member + "'");
+    }
+    r.copy = t->copy;
+    r.lateDays = lateDays(t->issueDay, t->returnDay);
+    r.fine = r.lateDays * FINE_PER_DAY;
+    return persisted({"RETURN", to_string(id), member, date}, DIRTY_BOOKS | DIRTY_TRANSACTIONS | DIRTY_HOLDS, r);
+}
+
+Result Library::placeHold(int id, const string &member, const string &date) {
+    if (!isDateString(date)) return failure(LibraryError::INVALID_INPUT, "date must be YYYY-MM-DD");
+    if (!findBook(id)) return failure(LibraryError::BOOK_NOT_FOUND, "book " + to_string(id) + " not found");
+    if (!getMember(member)) return failure(LibraryError::MEMBER_NOT_FOUND, "member '" + member + "' not found");
+    if (copies.available(id) > 0) {
+        return failure(LibraryError::COPIES_AVAILABLE, "book " + to_string(id) + " has copies available");
+    }
+    if (holds.has(id, member)) {
+        return failure(LibraryError::ALREADY_HELD, "'" + member + "' already holds book " + to_string(id));
+    }
+    auto loans = openLoansByMember.find(member);
+    if (loans != openLoansByMember.end()) {
+        for (size_t slot : loans->second) {
+            if (transactions[slot].bookId == id) {
+                return failure(LibraryError::ALREADY_ON_LOAN, "'" + member + "' already has book " + to_string(id));
+            }
+        }
+    }
+    applyPlaceHold(id, member, date);
+    return persisted({"HOLD", to_string(id), member, date}, DIRTY_HOLDS);
+}
+
+Result Library::cancelHold(int id, const string &member) {
+    if (!holds.remove(id, member)) {
+        return failure(LibraryError::NOT_HELD, "'" + member + "' has no hold on book " + to_string(id));
+    }
+    return persisted({"CANCEL_HOLD", to_string(id), member}, DIRTY_HOLDS);
+}
+
+LoginResult Library::login(const string &name, const string &pass) {
+    const Member* m = authenticate(name, pass);
+    if (!m) return failure<LoginResult>(LibraryError::BAD_CREDENTIALS, "invalid credentials");
+    LoginResult r;
+    r.name = string(m->name);
+    r.role = m->role;
+    if (needsRehash(*m)) {
+        Result saved = upgradeCredential(name, pass);
+        r.error = saved.error;
+        r.message = saved.message;
+    }
+    return r;
+}
+
+// ---- Bulk transfer ----
+TransferResult Library::exportTo(const string &dir, BulkFormat format) const {
+    using Clock = chrono::steady_clock;
+    Clock::time_point begin = Clock::now(), start = begin;
+    shared_ptr<const LibraryView> view = readView();
+    TransferResult r;
+    error_code ec;
+    filesystem::create_directories(dir, ec);
+    string ext = format == BulkFormat::CSV ? ".csv" : ".jsonl";
+    string failed;
+    auto finish = [&](BulkWriter &rows, const string &table) {
+        if (!rows.close()) {
+            failed = dir + "/" + table + ext;
+            return false;
+        }
+        Clock::time_point now = Clock::now();
+        r.tables.push_back({table + ext, rows.rowCount(), chrono::duration<double>(now - start).count()});
+        start = now;
+        return true;
+    };
+
+    unordered_map<int, string_view> shelf;
+    for (int32_t barcode = 1; barcode <= (int32_t)view->copyCount(); ++barcode) {
+        const CopyTable::Copy &c = view->copy(barcode);
+        if (c.status != CopyTable::WITHDRAWN) shelf.emplace(c.bookId, view->location(c));
+    }
+    BulkWriter bookRows(dir + "/books" + ext, {"id", "title", "author", "copies", "available", "location"}, format);
+    for (auto &b : view->books()) {
+        bookRows.number(b.id).text(b.title).text(b.author).number(view->totalCopies(b.id))
+            .number(view->availableCopies(b.id)).text(shelf[b.id]);
+        bookRows.endRow();
+    }
+    if (finish(bookRows, "books")) {
+        BulkWriter memberRows(dir + "/members" + ext, {"name", "password", "role"}, format);
+        for (auto &m : view->members()) {
+            memberRows.text(m.name).text(m.password).text(m.role);
+            memberRows.endRow();
+        }
+        if (finish(memberRows, "members")) {
+            BulkWriter loanRows(dir + "/transactions" + ext, {"bookId", "member", "issueDate", "returnDate"},
+                                format);
+            int from = numeric_limits<int>::min(), to = numeric_limits<int>::max();
+            for (auto &l : view->loanHistory(from, to, BY_ISSUE_DATE)) {
+                loanRows.number(l.bookId).text(l.member).text(dayLabel(l.issueDay)).text(dayLabel(l.returnDay));
+                loanRows.endRow();
+            }
+            finish(loanRows, "transactions");
+        }
+    }
+    if (!failed.empty()) return failure<TransferResult>(LibraryError::SAVE_FAILED, "cannot write " + failed);
+    r.seconds = chrono::duration<double>(Clock::now() - begin).count();
+    return r;
+}
+
+TransferResult Library::importFrom(const string &dir) {
+    using Clock = chrono::steady_clock;
+    Clock::time_point begin = Clock::now(), start = begin;
+    if (!members.empty() || !books.empty() || !transactions.empty() || archive.loanCount()) {
+        return failure<TransferResult>(LibraryError::INVALID_INPUT, "can only import into an empty library");
+    }
+    TransferResult r;
+    auto lap = [&](const string &file, size_t rows) {
+        Clock::time_point now = Clock::now();
+        if (!file.empty()) r.tables.push_back({file, rows, chrono::duration<double>(now - start).count()});
+        start = now;
+    };
+
+    struct StagedBook {
+        int id, total, available;  // available -1 when not given
+        string_view title, author, location;
+        size_t line;
+        int openLoans;
+    };
+    struct StagedMember {
+        string_view name, password;
+        string role;
+    };
+    struct StagedLoan {
+        int bookId;
+        size_t member;  // in stagedMembers
+        int issueDay, returnDay;
+    };
+    string bookData, memberData, loanData;
+    vector<StagedBook> stagedBooks;
+    vector<StagedMember> stagedMembers;
+    vector<StagedLoan> stagedLoans;
+    unordered_map<int, size_t> bookSlots;
+    unordered_map<string_view, size_t, CaseInsensitiveHash, CaseInsensitiveEqual> memberSlots;
+    auto stageBook = [&](size_t line, const vector<string_view> &v) -> string {
+        StagedBook b = {0, 0, -1, v[1], v[2], v[5], line, 0};
+        if (!parseInt(v[0], b.id)) return "book id must be a number";
+        if (b.title.empty() || b.author.empty()) return "title and author are required";
+        if (!parseInt(v[3], b.total) || b.total <= 0) return "copies must be at least 1";
+        if (!v[4].empty() && (!parseInt(v[4], b.available) || b.available < 0 || b.available > b.total)) {
+            return "available must be a number from 0 to copies";
+        }
+        if (!bookSlots.emplace(b.id, stagedBooks.size()).second) return "duplicate book id " + to_string(b.id);
+        stagedBooks.push_back(b);
+        return "";
+    };
+    auto stageMember = [&](size_t, const vector<string_view> &v) -> string {
+        StagedMember m = {v[0], v[1], toLowerCase(string(v[2]))};
+        if (m.name.empty() || m.password.empty()) return "name and password are required";
+        if (m.role != "admin" && m.role != "librarian" && m.role != "member") {
+            return "invalid role '" + string(v[2]) + "'";
+        }
+        if (!memberSlots.emplace(m.name, stagedMembers.size()).second) {
+            return "duplicate member '" + string(m.name) + "'";
+        }
+        stagedMembers.push_back(move(m));
+        return "";
+    };
+    // open loans are counted per book as they go by; the available
+    // counts are checked against them once every loan has been read
+    auto stageLoan = [&](size_t, const vector<string_view> &v) -> string {
+        StagedLoan t = {0, 0, parseDay(v[2]), parseReturnDay(v[3])};
+        if (!parseInt(v[0], t.bookId)) return "book id must be a number";
+        auto book = bookSlots.find(t.bookId);
+        if (book == bookSlots.end()) return "unknown book id " + to_string(t.bookId);
+        auto member = memberSlots.find(v[1]);
+        if (member == memberSlots.end()) return "unknown member '" + string(v[1]) + "'";
+        if (t.issueDay == INVALID_DAY) return "issue date must be YYYY-MM-DD";
+        if (t.returnDay == INVALID_DAY) return "return date must be YYYY-MM-DD or empty";
+        if (t.returnDay < t.issueDay) return "return date is before the issue date";
+        StagedBook &b = stagedBooks[book->second];
+        if (t.returnDay == OPEN_LOAN && ++b.openLoans > b.total) {
+            return "book " + to_string(b.id) + " has more open loans than its " + to_string(b.total) + " copies";
+        }
+        t.member = member->second;
+        stagedLoans.push_back(t);
+        return "";
+    };
+
+    string bookFile = readBulkTable(dir, "books", {"id", "title", "author", "copies", "available", "location"}, 4,
+                                    bookData, r.problems, stageBook);
+    lap(bookFile, stagedBooks.size());
+    string memberFile = readBulkTable(dir, "members", {"name", "password", "role"}, 3, memberData, r.problems,
+                                      stageMember);
+    lap(memberFile, stagedMembers.size());
+    string loanFile = readBulkTable(dir, "transactions", {"bookId", "member", "issueDate", "returnDate"}, 4,
+                                    loanData, r.problems, stageLoan);
+    if (bookFile.empty() && memberFile.empty() && loanFile.empty()) {
+        return failure<TransferResult>(LibraryError::INVALID_INPUT,
+                                       "no books, members or transactions .csv or .jsonl file in " + dir);
+    }
+    for (auto &b : stagedBooks) {
+        if (b.available >= 0 && b.available != b.total - b.openLoans) {
+            r.problems.push_back(bookFile + ":" + to_string(b.line) + ": available " + to_string(b.available) +
+                                 " but " + to_string(b.openLoans) + " of " + to_string(b.total) +
+                                 " copies are on loan");
+        }
+    }
+    lap(loanFile, stagedLoans.size());
+    if (!r.problems.empty()) {
+        r.error = LibraryError::INVALID_INPUT;
+        r.message = to_string(r.problems.size()) + " row(s) rejected; nothing was imported";
+        return r;
+    }
+
+    // everything checks out: apply it directly and build the indexes once
+    for (auto &m : stagedMembers) applyAddMember(string(m.name), string(m.password), m.role);
+    for (auto &b : stagedBooks) {
+        applyAddBook(b.id, string(b.title), string(b.author), b.total, string(b.location));
+    }
+    vector<Transaction> loaded;
+    loaded.reserve(stagedLoans.size());
+    for (auto &t : stagedLoans) {
+        int32_t copy = t.returnDay == OPEN_LOAN ? copies.take(t.bookId) : CopyTable::NONE;
+        loaded.push_back({t.bookId, names.intern(stagedMembers[t.member].name), t.issueDay, t.returnDay, copy});
+    }
+    transactions.assign(loaded);
+    rebuildOpenLoans();
+    rebuildDateIndexes();
+    stats.rebuild(transactions, names);
+    if (!compact()) return failure<TransferResult>(LibraryError::SAVE_FAILED, "could not save library data");
+    r.seconds = chrono::duration<double>(Clock::now() - begin).count();
+    return r;
+}
+
+// ---- Read views ----
+shared_ptr<const LibraryView> Library::readView() const {
+    lock_guard<mutex> lock(viewMutex);
+    // every counter only grows, so the sum changes whenever one does
+    uint64_t version = books.version() + members.version() + transactions.version() + copies.version() +
+                       names.size() +
+                       loansByIssueDay.version() + loansByReturnDay.version() + archive.all().size();
+    if (!currentView || version != viewVersion) {
+        currentView = make_shared<LibraryView>(books.snapshot(), members.snapshot(), transactions.snapshot(),
+                                               copies.snapshot(), names.snapshot(), copies.locationSnapshot(),
+                                               loansByIssueDay.snapshot(), loansByReturnDay.snapshot(),
+                                               archive.all(), archive);
+        viewVersion = version;
+    }
+    return currentView;
+}
+
+// ---- Read-only queries ----
+const CowVector<Book>& Library::allBooks() const {
+    return books;
+}
+
+const CowVector<Member>& Library::allMembers() const {
+    return members;
+}
+
+const CowVector<Transaction>& Library::allTransactions() const {
+    return transactions;
+}
+
+string_view Library::memberOf(const Transaction &t) const {
+    return names[t.memberId];
+}
+
+const Book* Library::getBook(int id) const {
+    auto it = bookIndex.find(id);
+    return it == bookIndex.end() ? nullptr : &books[it->second];
+}
+
+const Member* Library::getMember(string_view name) const {
+    auto it = memberIndex.find(name);
+    return it == memberIndex.end() ? nullptr : &members[it->second];
+}
+
+vector<SearchIndex::Hit> Library::search(const string &keywords, uint8_t fields, bool* approximate) const {
+    METRIC_SCOPE(OP_SEARCH);
+    vector<SearchIndex::Hit> hits = searchIndex.query(keywords, fields);
+    if (approximate) *approximate = false;
+    if (hits.empty() && approximate) {
+        hits = searchIndex.fuzzyQuery(keywords, fields, FUZZY_RESULTS);
+        *approximate = !hits.empty();
+    }
+    return hits;
+}
+
+const Member* Library::authenticate(const string &name, const string &pass) const {
+    METRIC_SCOPE(OP_LOGIN);
+    auto it = memberIndex.find(name);
+    if (it == memberIndex.end()) {
+        static const string decoy = hashPassword("decoy", DEFAULT_KDF_ITERATIONS);
+        StoredCredential cred;
+        parseCredential(decoy, cred);
+        unsigned char key[32];
+        pbkdf2Sha256(pass, cred.salt, storedIterations ? storedIterations : kdfIterations, key);
+        return nullptr;
+    }
+    const Member &m = members[it->second];
+    return verifyPassword(m.password, pass) ? &m : nullptr;
+}
+
+bool Library::needsRehash(const Member &m) const {
+    StoredCredential cred;
+    return !parseCredential(m.password, cred) || cred.iterations != kdfIterations;
+}
+
+Result Library::upgradeCredential(const string &name, const string &pass) {
+    string hash = hashPassword(pass, kdfIterations);
+    if (!applySetPassword(name, hash)) return Result();
+    return persisted({"SET_PASSWORD", name, hash}, DIRTY_MEMBERS);
+}
+
+MigrateResult Library::migratePasswords() {
+    MigrateResult r;
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (isHashedPassword(members[i].password)) continue;
+        Member &m = members.mutate(i);
+        m.password = hashPassword(m.password, kdfIterations);
+        ++r.migrated;
+    }
+    if (r.migrated) storedIterations = max(storedIterations, kdfIterations);
+    if (r.migrated && !compact()) {
+        return failure<MigrateResult>(LibraryError::SAVE_FAILED, "could not save library data");
+    }
+    return r;
+}
+
+void Library::setKdfIterations(uint32_t iterations) {
+    kdfIterations = iterations ? iterations : 1;
+}
+
+TransactionView Library::view(const Transaction &t) const {
+    return {t.bookId, t.copy, names[t.memberId], dayLabel(t.issueDay), dayLabel(t.returnDay)};
+}
+
+TransactionView Library::view(const LoanRecord &l) {
+    return LibraryView::view(l);
+}
+
+LoanRecord Library::record(const Transaction &t) const {
+    return {t.bookId, t.copy, t.issueDay, t.returnDay, names[t.memberId]};
+}
+
+vector<TransactionView> Library::openLoans(const string &member) const {
+    vector<TransactionView> loans;
+    auto it = openLoansByMember.find(member);
+    if (it != openLoansByMember.end()) {
+        for (size_t slot : it->second) loans.push_back(view(transactions[slot]));
+    }
+    return loans;
+}
+
+// ---- Date ranges ----
+vector<LoanRecord> Library::loanHistory(int fromDay, int toDay, DateField field) const {
+    return readView()->loanHistory(fromDay, toDay, field);
+}
+
+vector<TransactionView> Library::loansBetween(int fromDay, int toDay, DateField field) const {
+    return readView()->loansBetween(fromDay, toDay, field);
+}
+
+// ---- Copies ----
+int Library::totalCopies(int id) const {
+    return copies.total(id);
+}
+
+int Library::availableCopies(int id) const {
+    return copies.available(id);
+}
+
+const CopyTable& Library::copyTable() const {
+    return copies;
+}
+
+// ---- Holds ----
+string Library::holdHead(int id) const {
+    HoldQueues::Hold first;
+    return holds.head(id, first) ? string(first.member) : string();
+}
+
+vector<HoldQueues::Hold> Library::holdsOf(const string &member) const {
+    return holds.ofMember(member);
+}
+
+size_t Library::holdPosition(int id, const string &member) const {
+    return holds.position(id, member);
+}
+
+size_t Library::holdsQueued(int id) const {
+    return holds.queued(id);
+}
+
+// ---- Overdue loans and fines ----
+vector<Library::OverdueLoan> Library::overdueAsOf(int asOfDay) const {
+    vector<OverdueLoan> out;
+    for (auto it = openLoansByDueDay.begin(); it != openLoansByDueDay.end() && it->first < asOfDay; ++it) {
+        int late = asOfDay - it->first;
+        for (size_t slot : it->second) {
+            const Transaction &t = transactions[slot];
+            out.push_back({t.bookId, string(names[t.memberId]), dayLabel(t.issueDay), it->first, late,
+                           late * FINE_PER_DAY});
+        }
+    }
+    return out;
+}
+
+Library::FineTotals Library::computeFines(int asOfDay, ostream &csv) const {
+    FineTotals totals;
+    csv << "bookId,member,issueDate,returnDate,lateDays,fine\n";
+    auto charge = [&](const LoanRecord &t) {
+        int issued = t.issueDay;
+        int ended = t.open() ? asOfDay : t.returnDay;
+        if (issued == INVALID_DAY || ended == INVALID_DAY) return;
+        ++totals.loans;
+        int late = ended - issued - LOAN_PERIOD_DAYS;
+        if (late <= 0) return;
+        ++totals.lateLoans;
+        totals.fines += (long long)late * FINE_PER_DAY;
+        csv << t.bookId << ',' << csvField(t.member) << ',' << dayLabel(issued) << ','
+            << dayLabel(t.returnDay) << ',' << late << ',' << late * FINE_PER_DAY << '\n';
+    };
+    archive.forEach(numeric_limits<int>::min(), numeric_limits<int>::max(), false, charge);
+    for (auto &t : transactions) charge(record(t));
+    return totals;
+}
+
+const CirculationStats& Library::circulationStats() {
+    archive.countNew([this](const LoanRecord &l) {
+        stats.recordIssue(l.bookId, l.member, l.issueDay);
+        stats.recordReturn(l.bookId, l.issueDay, l.returnDay);
+    });
+    return stats;
+}
+
+size_t Library::memberCount() const {
+    return members.size();
+}
+
+size_t Library::bookCount() const {
+    return books.size();
+}
+
+size_t Library::transactionCount() const {
+    return transactions.size();
+}
+
+// ---- Metrics ----
+vector<pair<const char*, size_t>> Library::recordCounts() const {
+    return {{"members", members.size()},
+            {"books", books.size()},
+            {"copies", copies.size()},
+            {"transactions", transactions.size()},
+            {"archived_loans", archive.loanCount()},
+            {"open_loans", stats.totalLoans() - stats.returnedLoans()},
+            {"holds", holds.size()},
+            {"journal_records", journalRecords}};
+}
+
+string Library::metricsReport(bool json) const {
+    string out;
+    char num[64];
+    auto number = [&num](double value) {
+        snprintf(num, sizeof(num), "%.9g", value);
+        return string(num);
+    };
+    auto labels = [](int op) {
+        string text = string("op=\"") + METRIC_LABELS[op].first + "\"";
+        if (*METRIC_LABELS[op].second) text += string(",file=\"") + METRIC_LABELS[op].second + "\"";
+        return text;
+    };
+    auto counts = recordCounts();
+    if (json) {
+        out = "{\"records\":{";
+        for (size_t i = 0; i < counts.size(); ++i) {
+            out += string(i ? "," : "") + "\"" + counts[i].first + "\":" + to_string(counts[i].second);
+        }
+        out += "},\"operations\":[";
+#if LIBRARY_METRICS
+        for (int op = 0; op < METRIC_OPS; ++op) {
+            const LatencyHistogram &h = Metrics::of((MetricOp)op);
+            out += string(op ? "," : "") + "{\"op\":\"" + METRIC_LABELS[op].first + "\",\"file\":\"" +
+                   METRIC_LABELS[op].second + "\",\"count\":" + to_string(h.count()) +
+                   ",\"sum_seconds\":" + number(h.seconds()) + ",\"p50_us\":" + number(h.quantileMicros(0.5)) +
+                   ",\"p99_us\":" + number(h.quantileMicros(0.99)) + ",\"max_us\":" + number(h.maxMicros()) +
+                   ",\"buckets\":[";
+            for (int b = 0; b < LatencyHistogram::BUCKETS; ++b) out += (b ? "," : "") + to_string(h.inBucket(b));
+            out += "]}";
+        }
+#endif
+        out += "]}\n";
+        return out;
+    }
+    out = "# HELP library_records Records currently held, by kind.\n# TYPE library_records gauge\n";
+    for (auto &c : counts) out += string("library_records{kind=\"") + c.first + "\"} " + to_string(c.second) + "\n";
+#if LIBRARY_METRICS
+    out += "# HELP library_operation_duration_seconds Latency of library operations.\n"
+           "# TYPE library_operation_duration_seconds histogram\n";
+    for (int op = 0; op < METRIC_OPS; ++op) {
+        const LatencyHistogram &h = Metrics::of((MetricOp)op);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            cumulative += h.inBucket(b);
+            string le = b == LatencyHistogram::BUCKETS - 1 ? "+Inf" : number(LatencyHistogram::bound(b) / 1e6);
+            out += "library_operation_duration_seconds_bucket{" + labels(op) + ",le=\"" + le + "\"} " +
+                   to_string(cumulative) + "\n";
+        }
+        out += "library_operation_duration_seconds_sum{" + labels(op) + "} " + number(h.seconds()) + "\n";
+        out += "library_operation_duration_seconds_count{" + labels(op) + "} " + to_string(h.count()) + "\n";
+    }
+#else
+    (void)labels;
+    (void)number;
+#endif
+    return out;
+}
+
+bool Library::writeMetrics(const string &path) const {
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    ofstream file(path, ios::trunc);
+    file << metricsReport(json);
+    file.close();
+    return !file.fail();
+}
+
+// ---- File I/O ----
+void Library::loadMembers() {
+    METRIC_SCOPE(OP_LOAD_MEMBERS);
+    members.clear();
+    memberIndex.clear();
+    ifstream file(membersFile);
+    if (!file) return;
+    string name, password, role;
+    while (getline(file, name) && getline(file, password) && getline(file, role)) {
+        members.push_back({names.view(name), password, role});
+        // first record wins on duplicate names, as the old linear scan did
+        memberIndex.emplace(members.back().name, members.size() - 1);
+    }
+}
+
+bool Library::saveMembers(const string &path) {
+    METRIC_SCOPE(OP_SAVE_MEMBERS);
+    ofstream file(path, ios::trunc);
+    for (auto &m : members) {
+        file << m.name << "\n" << m.password << "\n" << m.role << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+void Library::loadBooks() {
+    METRIC_SCOPE(OP_LOAD_BOOKS);
+    books.clear();
+    bookIndex.clear();
+    ifstream file(booksFile);
+    if (!file) return;
+    Book b;
+    string title, author;
+    int total, available;
+    while (file >> b.id) {
+        file.ignore();
+        getline(file, title);
+        getline(file, author);
+        // the counts are derived from copies.txt; older data only has these
+        file >> total >> available;
+        file.ignore();
+        b.title = titles.add(title);
+        b.author = authors.view(author);
+        bookIndex.emplace(b.id, books.size());
+        books.push_back(b);
+        if (!copiesLoaded) synthesizeCopies(b.id, total);
+    }
+}
+
+bool Library::saveBooks(const string &path) {
+    METRIC_SCOPE(OP_SAVE_BOOKS);
+    ofstream file(path, ios::trunc);
+    for (auto &b : books) {
+        file << b.id << "\n" << b.title << "\n" << b.author << "\n"
+             << copies.total(b.id) << " " << copies.available(b.id) << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+void Library::loadTextFiles() {
+    thread membersLoader([this] { loadMembers(); });
+    thread booksLoader([this] { loadBooks(); });
+    loadTransactions([&] {
+        membersLoader.join();
+        booksLoader.join();
+    });
+}
+
+vector<size_t> Library::recordBoundaries(string_view data, size_t parts) {
+    vector<size_t> starts(parts), newlines(parts);
+    for (size_t i = 0; i < parts; ++i) starts[i] = data.size() * i / parts;
+    vector<thread> counters;
+    for (size_t i = 0; i < parts; ++i) {
+        counters.emplace_back([&, i] {
+            size_t end = i + 1 < parts ? starts[i + 1] : data.size();
+            newlines[i] = (size_t)count(data.begin() + starts[i], data.begin() + end, '\n');
+        });
+    }
+    for (auto &t : counters) t.join();
+    vector<size_t> cuts = {0};
+    size_t linesBefore = 0;
+    for (size_t i = 1; i < parts; ++i) {
+        linesBefore += newlines[i - 1];
+        size_t pos = starts[i], line = linesBefore;
+        if (data[pos - 1] != '\n') {
+            pos = data.find('\n', pos);
+            if (pos == string_view::npos) break;
+            ++pos;
+            ++line;
+        }
+        while (line % 4 != 0 && pos < data.size()) {
+            pos = data.find('\n', pos);
+            if (pos == string_view::npos) pos = data.size();
+            else ++pos;
+            ++line;
+        }
+        if (pos > cuts.back() && pos < data.size()) cuts.push_back(pos);
+    }
+    cuts.push_back(data.size());
+    return cuts;
+}
+
+void Library::parseTransactionChunk(string_view text, ParsedChunk &out) {
+    unordered_map<string_view, uint32_t> localIds;
+    size_t pos = 0;
+    auto nextLine = [&](string_view &line) {
+        if (pos >= text.size()) return false;
+        size_t nl = text.find('\n', pos);
+        if (nl == string_view::npos) nl = text.size();
+        line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+        return true;
+    };
+    auto skipSpaces = [](const char* p, const char* end) {
+        while (p < end && isspace((unsigned char)*p)) ++p;
+        return p;
+    };
+    string_view head, member, issued, returned;
+    while (nextLine(head)) {
+        Transaction t;
+        const char* end = head.data() + head.size();
+        auto parsed = from_chars(skipSpaces(head.data(), end), end, t.bookId);
+        if (parsed.ec != errc()) {
+            out.malformed = !head.empty() || pos < text.size();
+            return;
+        }
+        const char* rest = skipSpaces(parsed.ptr, end);
+        if (rest == end || from_chars(rest, end, t.copy).ec != errc()) t.copy = CopyTable::NONE;
+        member = issued = returned = string_view();
+        nextLine(member);
+        nextLine(issued);
+        nextLine(returned);
+        auto id = localIds.emplace(member, (uint32_t)out.memberNames.size());
+        if (id.second) out.memberNames.push_back(member);
+        t.memberId = id.first->second;
+        t.issueDay = parseDay(issued);
+        t.returnDay = parseReturnDay(returned);
+        out.loans.push_back(t);
+    }
+}
+
+void Library::loadTransactions(const function<void()> &beforeMerge) {
+    METRIC_SCOPE(OP_LOAD_TRANSACTIONS);
+    transactions.clear();
+    string data;
+    if (!readWholeFile(transactionsFile, data)) {
+        beforeMerge();
+        return;
+    }
+    size_t parts = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), data.size() / (1 << 20) + 1));
+    vector<size_t> cuts = recordBoundaries(data, parts);
+    vector<ParsedChunk> chunks(cuts.size() - 1);
+    vector<thread> parsers;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        string_view slice(data.data() + cuts[i], cuts[i + 1] - cuts[i]);
+        if (i + 1 == chunks.size()) parseTransactionChunk(slice, chunks[i]);
+        else parsers.emplace_back([&chunks, slice, i] { parseTransactionChunk(slice, chunks[i]); });
+    }
+    for (auto &t : parsers) t.join();
+    beforeMerge();
+
+    // a malformed record ends the history, as it always has
+    size_t used = 0, total = 0;
+    while (used < chunks.size()) {
+        total += chunks[used].loans.size();
+        if (chunks[used++].malformed) break;
+    }
+    // interning in chunk order keeps ids in order of first appearance
+    vector<vector<uint32_t>> poolIds(used);
+    for (size_t i = 0; i < used; ++i) {
+        for (string_view name : chunks[i].memberNames) poolIds[i].push_back(names.intern(name));
+    }
+    vector<Transaction> loaded(total);
+    vector<thread> copiers;
+    size_t offset = 0;
+    for (size_t i = 0; i < used; ++i) {
+        copiers.emplace_back([&loaded, &chunks, &poolIds, i, offset] {
+            Transaction* dest = loaded.data() + offset;
+            for (const Transaction &t : chunks[i].loans) {
+                *dest = t;
+                dest->memberId = poolIds[i][t.memberId];
+                ++dest;
+            }
+        });
+        offset += chunks[i].loans.size();
+    }
+    for (auto &t : copiers) t.join();
+    if (!copiesLoaded) {
+        for (auto &t : loaded) {
+            if (t.open()) t.copy = copies.take(t.bookId);
+        }
+    }
+    transactions.assign(loaded);
+}
+
+bool Library::saveTransactions(const string &path, const vector<bool> &archived) {
+    METRIC_SCOPE(OP_SAVE_TRANSACTIONS);
+    ofstream file(path, ios::trunc);
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        if (archived[i]) continue;
+        const Transaction &t = transactions[i];
+        file << t.bookId;
+        if (t.copy != CopyTable::NONE) file << " " << t.copy;
+        file << "\n" << names[t.memberId] << "\n" << dayLabel(t.issueDay) << "\n"
+             << dayLabel(t.returnDay) << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+void Library::loadHolds() {
+    METRIC_SCOPE(OP_LOAD_HOLDS);
+    holds.clear();
+    ifstream file(holdsFile);
+    if (!file) return;
+    int id;
+    string member, date;
+    while (file >> id) {
+        file.ignore();
+        getline(file, member);
+        getline(file, date);
+        applyPlaceHold(id, member, date);
+    }
+}
+
+bool Library::saveHolds(const string &path) {
+    METRIC_SCOPE(OP_SAVE_HOLDS);
+    ofstream file(path, ios::trunc);
+    for (auto &h : holds.all()) {
+        file << h.bookId << "\n" << h.member << "\n" << dayLabel(h.holdDay) << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+bool Library::loadCopies() {
+    METRIC_SCOPE(OP_LOAD_COPIES);
+    copies.clear();
+    ifstream file(copiesFile);
+    if (!file) return false;
+    int barcode, id;
+    string status, location;
+    while (file >> barcode >> id) {
+        file.ignore();
+        getline(file, status);
+        getline(file, location);
+        CopyTable::Status parsed;
+        if (!CopyTable::parseStatus(status, parsed)) parsed = CopyTable::WITHDRAWN;
+        copies.add(id, location, parsed);
+    }
+    return true;
+}
+
+bool Library::saveCopies(const string &path) {
+    METRIC_SCOPE(OP_SAVE_COPIES);
+    ofstream file(path, ios::trunc);
+    for (int32_t barcode = 1; barcode <= (int32_t)copies.size(); ++barcode) {
+        const CopyTable::Copy &c = copies[barcode];
+        file << barcode << " " << c.bookId << "\n" << CopyTable::statusName(c.status) << "\n"
+             << copies.location(c) << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+void Library::synthesizeCopies(int id, int total) {
+    for (int i = 0; i < total; ++i) copies.add(id, DEFAULT_LOCATION);
+}
+
+bool Library::loadSnapshot() {
+    METRIC_SCOPE(OP_LOAD_SNAPSHOT);
+    if (!ifstream(snapshotFile).good()) return false;
+    SnapshotReader snap;
+    string error;
+    if (!snap.open(snapshotFile, error)) {
+        loadWarning = error + "; loaded text files instead";
+        return false;
+    }
+    binarySnapshot = true;
+
+    members.clear();
+    memberIndex.clear();
+    for (size_t i = 0; i < snap.memberCount(); ++i) {
+        const SnapMember &r = snap.memberAt(i);
+        members.push_back({names.view(snap.str(r.name)), string(snap.str(r.password)),
+                           string(snap.str(r.role))});
+        memberIndex.emplace(members.back().name, i);
+    }
+
+    books.clear();
+    bookIndex.clear();
+    for (size_t i = 0; i < snap.bookCount(); ++i) {
+        const SnapBook &r = snap.bookAt(i);
+        books.push_back({r.id, titles.add(snap.str(r.title)), authors.view(snap.str(r.author))});
+        bookIndex.emplace(r.id, i);
+        if (!copiesLoaded) synthesizeCopies(r.id, r.totalCopies);
+    }
+
+    transactions.clear();
+    for (size_t i = 0; i < snap.transactionCount(); ++i) {
+        const SnapTransaction &r = snap.transactionAt(i);
+        Transaction t = {r.bookId, names.intern(snap.str(r.memberName)), parseDay(snap.str(r.issueDate)),
+                         parseReturnDay(snap.str(r.returnDate)), r.copy};
+        if (!copiesLoaded && t.open()) t.copy = copies.take(t.bookId);
+        transactions.push_back(t);
+    }
+    return true;
+}
+
+bool Library::saveSnapshot(const string &path, const vector<bool> &archived) {
+    METRIC_SCOPE(OP_SAVE_SNAPSHOT);
+    SnapshotWriter writer;
+    vector<SnapMember> m;
+    vector<SnapBook> b;
+    vector<SnapTransaction> t;
+    m.reserve(members.size());
+    b.reserve(books.size());
+    t.reserve(transactions.size());
+    for (auto &x : members) {
+        m.push_back({writer.add(x.name), writer.add(x.password), writer.add(x.role)});
+    }
+    for (auto &x : books) {
+        b.push_back({x.id, copies.total(x.id), copies.available(x.id), 0, writer.add(x.title),
+                     writer.add(x.author)});
+    }
+    // the writer keeps views, so each distinct date label is built once and kept here
+    unordered_map<int, string> labels;
+    auto dateLabel = [&labels](int day) -> string_view {
+        auto it = labels.find(day);
+        if (it == labels.end()) it = labels.emplace(day, dayLabel(day)).first;
+        return it->second;
+    };
+    for (size_t i = 0; i < transactions.size(); ++i) {
+        if (archived[i]) continue;
+        const Transaction &x = transactions[i];
+        t.push_back({x.bookId, x.copy, writer.add(names[x.memberId]), writer.add(dateLabel(x.issueDay)),
+                     writer.add(dateLabel(x.returnDay))});
+    }
+    return writer.write(path, m, b, t);
+}
+
+// ===== Branches =====
+BranchCatalog::BranchCatalog(const vector<pair<string, string>> &dirs, bool journaled, size_t compactEvery) {
+    for (auto &d : dirs) {
+        if (!d.second.empty()) filesystem::create_directories(d.second);
+        branches.push_back(make_unique<Branch>());
+        branches.back()->name = d.first;
+    }
+    forEachBranch([&](size_t i) {
+        branches[i]->lib = make_unique<Library>(journaled, compactEvery, dirs[i].second);
+    });
+}
+
+size_t BranchCatalog::size() const {
+    return branches.size();
+}
+
+BranchCatalog::Branch& BranchCatalog::operator[](size_t i) {
+    return *branches[i];
+}
+
+const BranchCatalog::Branch& BranchCatalog::operator[](size_t i) const {
+    return *branches[i];
+}
+
+size_t BranchCatalog::find(string_view name) const {
+    for (size_t i = 0; i < branches.size(); ++i) {
+        if (equalsIgnoreCase(branches[i]->name, name)) return i;
+    }
+    return branches.size();
+}
+
+vector<BranchCatalog::BranchHit> BranchCatalog::search(const string &keywords, bool* approximate) const {
+    vector<vector<BranchHit>> found(branches.size());
+    vector<char> fuzzy(branches.size(), 0);
+    forEachBranch([&](size_t i) {
+        const Branch &b = *branches[i];
+        shared_lock<shared_mutex> lock(b.lock);
+        bool approx = false;
+        for (auto &hit : b.lib->search(keywords, SearchIndex::FIELD_ANY, &approx)) {
+            const Book* book = b.lib->getBook(hit.bookId);
+            if (!book) continue;
+            found[i].push_back({i, hit.bookId, hit.score, string(book->title), string(book->author),
+                                b.lib->availableCopies(hit.bookId), b.lib->totalCopies(hit.bookId)});
+        }
+        fuzzy[i] = approx;
+    });
+    bool anyExact = false;
+    for (size_t i = 0; i < branches.size(); ++i) anyExact = anyExact || (!fuzzy[i] && !found[i].empty());
+    vector<BranchHit> merged;
+    for (size_t i = 0; i < branches.size(); ++i) {
+        if (anyExact && fuzzy[i]) continue;
+        merged.insert(merged.end(), found[i].begin(), found[i].end());
+    }
+    stable_sort(merged.begin(), merged.end(),
+                [](const BranchHit &a, const BranchHit &b) { return a.score > b.score; });
+    if (approximate) *approximate = !anyExact && !merged.empty();
+    return merged;
+}
+
+vector<BranchCatalog::BranchStock> BranchCatalog::availability(int id) const {
+    vector<BranchStock> stock(branches.size(), {0, 0, 0});
+    forEachBranch([&](size_t i) {
+        const Branch &b = *branches[i];
+        shared_lock<shared_mutex> lock(b.lock);
+        stock[i] = {i, b.lib->availableCopies(id), b.lib->totalCopies(id)};
+    });
+    stock.erase(remove_if(stock.begin(), stock.end(), [](const BranchStock &s) { return s.total == 0; }),
+                stock.end());
+    return stock;
+}
@@ -0,0 +1,1777 @@
+#ifndef LIBRARY_CORE_H
+#define LIBRARY_CORE_H
+
+// Library core: records, indexes, persistence and the operations on them.
+// No console I/O; the menus, batch runner, server and benchmarks in
+// library.cpp are all clients of the Library class below. Only templates
+// are defined here; everything else is defined in library_core.cpp.
+
+#include <ostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <limits>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <random>
+#include <filesystem>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cerrno>
+
+// Latency instrumentation; build with -DLIBRARY_METRICS=0 to compile it out
+#ifndef LIBRARY_METRICS
+#define LIBRARY_METRICS 1
+#endif
+
+// ===== Helpers =====
+// Get current date as string "YYYY-MM-DD"
+std::string currentDate();
+
+// Days since 1970-01-01 for a proleptic Gregorian date (no time zone involved)
+int daysFromCivil(int y, int m, int d);
+
+// Inverse of daysFromCivil
+void civilFromDays(int days, int &y, int &m, int &d);
+
+// Day number formatted as "YYYY-MM-DD"
+std::string civilDate(int days);
+
+bool isDateString(std::string_view s);
+
+const int INVALID_DAY = std::numeric_limits<int>::min();
+
+// "YYYY-MM-DD" -> day number, or INVALID_DAY if malformed
+int parseDay(std::string_view date);
+
+// Return day recorded for a loan that is still out
+const int OPEN_LOAN = std::numeric_limits<int>::max();
+
+// Stored return date ("" while out) -> day number, OPEN_LOAN or INVALID_DAY
+int parseReturnDay(std::string_view date);
+
+// Inverse of parseDay/parseReturnDay for the text files and displays. Malformed
+// dates keep a non-empty placeholder so a returned loan never reads as open.
+std::string dayLabel(int day);
+
+// Months since year 0 (year * 12 + month - 1), for month buckets
+int monthOfDay(int days);
+
+std::string monthLabel(int month);
+
+const int LOAN_PERIOD_DAYS = 14;  // days allowed borrowing period
+const int FINE_PER_DAY = 10;      // fine amount per late day
+
+// Days past the loan period (0 if returned in time or either day is unknown)
+int lateDays(int issueDay, int returnDay);
+
+std::string toLowerCase(std::string str);
+
+// Compare two strings ignoring ASCII case, without allocating lowercased copies
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+bool containsIgnoreCase(std::string_view haystack, std::string_view needle);
+
+// Hash / equality pair for case-insensitive keys (FNV-1a over folded bytes)
+struct CaseInsensitiveHash {
+    size_t operator()(std::string_view s) const;
+};
+
+struct CaseInsensitiveEqual {
+    bool operator()(std::string_view a, std::string_view b) const;
+};
+
+// ---- Journal record encoding ----
+// Records are one line of tab-separated fields; tabs, newlines and backslashes
+// inside a field are escaped so free-text titles cannot break the framing.
+std::string escapeField(const std::string &s);
+
+std::vector<std::string> splitRecord(const std::string &line);
+
+std::string makeRecord(const std::vector<std::string> &fields);
+
+// ---- Batch input and bulk file parsing ----
+// Strict integer parse: the whole string must be a number
+bool parseInt(std::string_view s, int &out);
+
+// Reads a whole file with one read call; false if it cannot be opened
+bool readWholeFile(const std::string &path, std::string &out);
+
+// The CSV and JSON readers work through text held in one mutable buffer (a
+// whole bulk file, or a single batch line), record by record. Fields come
+// back as views into the buffer: quotes and escapes are undone where the
+// text lies (it only ever gets shorter), so reading a record does not
+// allocate once the field vector has grown.
+struct BulkCursor {
+    size_t pos = 0;
+    size_t lineBreaks = 0;  // before pos
+    size_t recordLine = 0;  // line the record last returned starts on (1-based)
+};
+
+// Next non-blank CSV record; double-quoted fields may contain commas, ""
+// escapes and line breaks. False at the end.
+bool parseCsvLine(std::string &data, BulkCursor &at, std::vector<std::string_view> &fields);
+
+// One CSV row as strings (a single empty field for a blank line)
+std::vector<std::string> parseCsvLine(const std::string &line);
+
+// Quote a CSV field when it contains a separator, quote or line break
+std::string csvField(std::string_view s);
+
+void appendUtf8(std::string &out, unsigned cp);
+
+// Next non-blank line as a flat JSON object: (key, value) pairs of string,
+// number, true/false/null values, non-string values as their literal text.
+// False at the end; a line that is not such an object is still consumed,
+// with malformed set.
+bool parseJsonObject(std::string &data, BulkCursor &at,
+                     std::vector<std::pair<std::string_view, std::string_view>> &fields, bool &malformed);
+
+// One line as a flat JSON object; a repeated key keeps its last value
+bool parseJsonObject(const std::string &line, std::unordered_map<std::string, std::string> &out);
+
+// Appends s as a quoted JSON string
+void appendJsonString(std::string &out, std::string_view s);
+
+// ===== Data structures =====
+// ===== Compact string storage =====
+// Append-only arena: text is copied into large blocks and handed out as
+// string_views that stay valid for the arena's lifetime, so records can refer
+// to it without owning a heap string each. Replaced text is not reclaimed until
+// the owner is reloaded.
+class StringArena {
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = BLOCK_SIZE;  // bytes taken in blocks.back()
+    size_t total = 0;
+
+public:
+    std::string_view add(std::string_view text);
+    size_t bytes() const;
+};
+
+// ===== Copy-on-write storage =====
+// Vector split into fixed-size chunks held by shared pointers, so a frozen
+// copy of it (snapshot()) costs one pointer per chunk. The owner keeps
+// writing afterwards: each chunk remembers how many snapshots existed when
+// it was made, and the first write to a chunk older than the latest
+// snapshot copies it, leaving the snapshot's version untouched. References
+// to elements are invalidated by writes to the same chunk.
+template <typename T>
+class CowVector {
+public:
+    static const size_t CHUNK_BITS = 10;
+    static const size_t CHUNK = size_t(1) << CHUNK_BITS;
+
+private:
+    struct Chunk {
+        uint64_t epoch;   // snapshots taken before this chunk was made
+        std::vector<T> items;  // up to CHUNK elements
+    };
+
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t count = 0;
+    uint64_t writes = 0;
+    // bumped by snapshot(), which readers call under the owner's read lock
+    // (serialized among themselves, see Library::readView)
+    mutable uint64_t epoch = 0;
+
+    CowVector(const CowVector&) = default;
+
+    Chunk& writable(size_t chunk) {
+        ++writes;
+        std::shared_ptr<Chunk> &c = chunks[chunk];
+        if (c->epoch != epoch) {
+            auto copy = std::make_shared<Chunk>();
+            copy->epoch = epoch;
+            copy->items.reserve(CHUNK);
+            copy->items.assign(c->items.begin(), c->items.end());
+            c = std::move(copy);
+        }
+        return *c;
+    }
+
+public:
+    // Random access, so sorted contents can be binary searched in place
+    class const_iterator {
+    private:
+        const CowVector* owner;
+        size_t i;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator(const CowVector* v, size_t at) : owner(v), i(at) {}
+        const T& operator*() const { return (*owner)[i]; }
+        const T* operator->() const { return &(*owner)[i]; }
+        const T& operator[](difference_type n) const { return (*owner)[i + n]; }
+        const_iterator& operator++() {
+            ++i;
+            return *this;
+        }
+        const_iterator& operator--() {
+            --i;
+            return *this;
+        }
+        const_iterator operator++(int) { return const_iterator(owner, i++); }
+        const_iterator operator--(int) { return const_iterator(owner, i--); }
+        const_iterator& operator+=(difference_type n) {
+            i += n;
+            return *this;
+        }
+        const_iterator& operator-=(difference_type n) {
+            i -= n;
+            return *this;
+        }
+        const_iterator operator+(difference_type n) const { return const_iterator(owner, i + n); }
+        const_iterator operator-(difference_type n) const { return const_iterator(owner, i - n); }
+        difference_type operator-(const const_iterator &o) const { return (difference_type)i - (difference_type)o.i; }
+        bool operator==(const const_iterator &o) const { return i == o.i; }
+        bool operator!=(const const_iterator &o) const { return i != o.i; }
+        bool operator<(const const_iterator &o) const { return i < o.i; }
+        bool operator>(const const_iterator &o) const { return i > o.i; }
+        bool operator<=(const const_iterator &o) const { return i <= o.i; }
+        bool operator>=(const const_iterator &o) const { return i >= o.i; }
+    };
+
+    CowVector() = default;
+    CowVector(CowVector&&) = default;
+
+    // Replaces the contents with items (bulk loads and rebuilds)
+    void assign(const std::vector<T> &items) {
+        clear();
+        for (size_t at = 0; at < items.size(); at += CHUNK) {
+            auto c = std::make_shared<Chunk>();
+            c->epoch = epoch;
+            c->items.reserve(CHUNK);
+            c->items.assign(items.begin() + at, items.begin() + std::min(items.size(), at + CHUNK));
+            chunks.push_back(std::move(c));
+        }
+        count = items.size();
+    }
+
+    // Frozen copy of the current contents; later writes here do not show in it
+    CowVector snapshot() const {
+        ++epoch;
+        return *this;
+    }
+
+    // Changes made so far; equal values mean equal contents
+    uint64_t version() const { return writes; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return chunks[i >> CHUNK_BITS]->items[i & (CHUNK - 1)]; }
+    const T& back() const { return (*this)[count - 1]; }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    // Element i for writing
+    T& mutate(size_t i) { return writable(i >> CHUNK_BITS).items[i & (CHUNK - 1)]; }
+
+    void push_back(const T &item) {
+        if (count % CHUNK == 0) {
+            auto c = std::make_shared<Chunk>();
+            c->epoch = epoch;
+            c->items.reserve(CHUNK);
+            chunks.push_back(std::move(c));
+        }
+        writable(chunks.size() - 1).items.push_back(item);
+        ++count;
+    }
+
+    void pop_back() {
+        writable(chunks.size() - 1).items.pop_back();
+        if (--count % CHUNK == 0) chunks.pop_back();
+    }
+
+    // Shifts the tail up by one
+    void insert(size_t at, const T &item) {
+        T value = item;  // item may live in a chunk the shift replaces
+        push_back(value);
+        for (size_t i = count - 1; i > at; --i) {
+            T prev = (*this)[i - 1];
+            mutate(i) = prev;
+        }
+        mutate(at) = value;
+    }
+
+    // Shifts the tail down by one
+    void erase(size_t at) {
+        for (size_t i = at; i + 1 < count; ++i) {
+            T next = (*this)[i + 1];  // copied first: mutate() may replace the chunk holding it
+            mutate(i) = next;
+        }
+        pop_back();
+    }
+
+    void clear() {
+        ++writes;
+        chunks.clear();
+        count = 0;
+    }
+};
+
+// Interned strings: each distinct value is stored once in the arena and named
+// by a dense 32-bit id. Matching is exact; callers fold case where they need to.
+class StringPool {
+private:
+    StringArena arena;
+    CowVector<std::string_view> values;
+    std::unordered_map<std::string_view, uint32_t> ids;
+
+public:
+    uint32_t intern(std::string_view text);
+    std::string_view view(std::string_view text);
+    std::string_view operator[](uint32_t id) const;
+    size_t size() const;
+    size_t bytes() const;
+
+    // Values by id as of now, for a read view (the text itself never moves)
+    CowVector<std::string_view> snapshot() const;
+};
+
+// Names, authors and titles below are views into the owning Library's string
+// storage (names and authors interned, titles in an arena), so the records
+// themselves hold no heap allocations besides the password hash.
+struct Member {
+    std::string_view name;
+    std::string password;
+    std::string role;
+};
+
+// Copy counts live in the Library's CopyTable (totalCopies/availableCopies)
+struct Book {
+    int id;
+    std::string_view title;
+    std::string_view author;
+};
+
+// Loan as stored: 20 bytes with the member interned and dates as day numbers
+struct Transaction {
+    int32_t bookId;
+    uint32_t memberId;   // id in the Library's name pool
+    int32_t issueDay;
+    int32_t returnDay;   // OPEN_LOAN while the book is out
+    int32_t copy;        // barcode of the copy lent, 0 if not recorded
+
+    bool open() const;
+};
+
+// A loan with its fields spelled out, for callers outside the Library
+struct TransactionView {
+    int bookId;
+    int copy;
+    std::string_view memberName;
+    std::string issueDate;
+    std::string returnDate;   // "" while the book is out
+};
+
+// A live or archived loan with the borrower's name resolved
+struct LoanRecord {
+    int32_t bookId;
+    int32_t copy;
+    int32_t issueDay;
+    int32_t returnDay;
+    std::string_view member;  // view into the owning Library's (or its archive's) name storage
+
+    bool open() const;
+};
+
+// Which date of a loan a date-range query goes by
+enum DateField { BY_ISSUE_DATE, BY_RETURN_DATE };
+
+// ===== Password hashing =====
+// Member passwords are stored as "pbkdf2-sha256$<iterations>$<salt hex>$<key hex>"
+// (PBKDF2-HMAC-SHA256 with a random 16-byte salt) of the password as typed.
+class Sha256 {
+private:
+    uint32_t state[8];
+    uint64_t length = 0;
+    unsigned char block[64];
+    size_t used = 0;
+
+    static uint32_t rotr(uint32_t x, int n);
+    void compress(const unsigned char* p);
+
+public:
+    Sha256();
+    void update(const void* data, size_t len);
+    void finish(unsigned char out[32]);
+};
+
+// PBKDF2-HMAC-SHA256 with a 32-byte output (one block). The keyed inner and
+// outer hash states are computed once and copied for every iteration.
+void pbkdf2Sha256(const std::string &password, const std::string &salt, uint32_t iterations, unsigned char out[32]);
+
+const uint32_t DEFAULT_KDF_ITERATIONS = 100000;
+
+std::string toHex(const unsigned char* data, size_t len);
+
+bool fromHex(const std::string &hex, std::string &out);
+
+// Compares every byte regardless of where the first difference is
+bool constantTimeEquals(const unsigned char* a, const unsigned char* b, size_t len);
+
+// Salted hash of the password exactly as typed (passwords are case-sensitive)
+std::string hashPassword(const std::string &password, uint32_t iterations);
+
+struct StoredCredential {
+    uint32_t iterations = 0;
+    std::string salt;
+    std::string key;
+};
+
+// Decodes a stored hash; false for legacy plaintext (or malformed) entries
+bool parseCredential(const std::string &stored, StoredCredential &cred);
+
+bool isHashedPassword(const std::string &stored);
+
+// Checks a password against a stored hash, byte for byte. Legacy plaintext
+// entries still match ignoring case until they are re-hashed.
+bool verifyPassword(const std::string &stored, const std::string &password);
+
+// ===== Search index =====
+// Split text into lowercase alphanumeric tokens ("Harry Potter-1" -> harry, potter, 1)
+std::vector<std::string> tokenize(std::string_view text);
+
+// Edit distance between pattern (at most 64 bytes) and text, counting an
+// adjacent transposition as one edit ("tolkein" -> "tolkien"). Uses Myers'
+// bit-parallel algorithm with Hyyro's transposition term: one 64-bit word holds
+// a whole DP column, so each text character costs a handful of word operations.
+// Returns limit + 1 as soon as the distance is known to exceed limit.
+int boundedEditDistance(std::string_view pattern, std::string_view text, int limit);
+
+// Typos tolerated in a query word of the given length
+int typoBudget(size_t length);
+
+// Trigram index over a vocabulary of words (the search tokens), used to find
+// the words within a few edits of a misspelled query word. Words are padded
+// with a boundary mark so every character is in some trigram; an edit changes
+// at most 4 trigrams (3, or 4 for a transposition), which bounds how many a
+// close word must share. A candidate must share at least one, so a 4-letter
+// word with its middle letters swapped is not found.
+class TrigramIndex {
+public:
+    struct Match {
+        std::string_view word;
+        int distance;
+    };
+
+private:
+    struct Word {
+        std::string text;
+        uint8_t grams = 0;  // distinct trigrams
+        bool live = false;
+    };
+
+    std::vector<Word> words;  // slot -> word; freed slots are reused
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::string, uint32_t> slots;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings;  // trigram -> slots (unordered)
+
+    static std::vector<uint32_t> trigrams(std::string_view word);
+
+public:
+    void clear();
+    void insert(const std::string &word);
+    void erase(const std::string &word);
+
+    // Words within maxDistance edits of query, excluding query itself
+    std::vector<Match> near(std::string_view query, int maxDistance) const;
+
+    size_t size() const;
+};
+
+// Inverted index over book titles and authors. Postings are kept sorted by
+// book id per token; the token map is ordered so a prefix is a range scan.
+class SearchIndex {
+public:
+    enum Field : uint8_t { FIELD_TITLE = 1, FIELD_AUTHOR = 2, FIELD_ANY = 3 };
+
+    struct Hit {
+        int bookId;
+        int score;
+    };
+
+private:
+    struct Posting {
+        int bookId;
+        uint8_t fields;
+    };
+    std::map<std::string, std::vector<Posting>> postings;
+    TrigramIndex vocabulary;  // the tokens in postings, for typo-tolerant lookups
+
+    static bool byId(const Posting &p, int id);
+    void addTokens(int id, std::string_view text, uint8_t field);
+    void removeTokens(int id, std::string_view text);
+
+    // A term's matches: one hit per book, sorted by book id. Tokens are
+    // appended with add() and merged by finish(), keeping the best score.
+    struct TermHits {
+        std::vector<Hit> hits;
+        size_t tokens = 0;
+
+        void add(const std::vector<Posting> &list, uint8_t fieldMask, int titleScore, int authorScore);
+        void finish();
+    };
+
+    // Books matched by every term, scored by the sum of their term scores.
+    // Walks the shortest list and advances a cursor into each of the others.
+    static std::vector<Hit> intersect(const std::vector<TermHits> &terms);
+
+    static bool ranked(const Hit &a, const Hit &b);
+
+public:
+    void clear();
+    void add(int id, std::string_view title, std::string_view author);
+    void remove(int id, std::string_view title, std::string_view author);
+
+    // Every query word must match (as a whole token or a token prefix) in one of
+    // the requested fields. Whole-word and title matches rank higher.
+    std::vector<Hit> query(const std::string &text, uint8_t fieldMask) const;
+
+    // Like query(), but a word may also match tokens a few typos away (one
+    // edit for 4-7 letters, two from 8). Exact and prefix matches still rank
+    // first; a typo match ranks below both, lower the more edits it needs.
+    // Returns the best `limit` hits.
+    std::vector<Hit> fuzzyQuery(const std::string &text, uint8_t fieldMask, size_t limit) const;
+};
+
+// ===== Circulation analytics =====
+// Running aggregates over the loan history. recordIssue/recordReturn keep
+// them current in O(1); rebuild() recomputes them from the full history by
+// first projecting it into columns (book id, member, issue day, return day).
+class CirculationStats {
+public:
+    struct BookStats {
+        size_t loans = 0;
+        size_t open = 0;
+        long long openIssueDaySum = 0;  // lets open loan-days be derived for any date
+        long long closedDays = 0;       // total days of returned loans
+    };
+
+    struct Ranked {
+        int bookId;
+        double value;
+    };
+
+private:
+    std::unordered_map<int, BookStats> byBook;
+    std::map<int, size_t> byMonth;
+    // keys are pooled member names, which outlive the stats
+    std::unordered_map<std::string_view, std::map<int, size_t>, CaseInsensitiveHash, CaseInsensitiveEqual>
+        byMemberMonth;
+    size_t loans = 0, returned = 0;
+    long long returnedDays = 0;
+    int firstDay = INVALID_DAY;
+
+public:
+    void clear();
+    void recordIssue(int bookId, std::string_view member, int issueDay);
+    void recordReturn(int bookId, int issueDay, int returnDay);
+    void rebuild(const CowVector<Transaction> &history, const StringPool &names);
+    size_t totalLoans() const;
+    size_t returnedLoans() const;
+    double averageLoanDays() const;
+    const std::map<int, size_t>& loansByMonth() const;
+    std::map<int, size_t> memberMonths(std::string_view member) const;
+
+    // Most-borrowed books, highest loan count first
+    std::vector<Ranked> topBorrowed(size_t k) const;
+
+    // Share of copy-days spent on loan since the first recorded issue, per book
+    std::vector<Ranked> topUtilization(size_t k, int asOfDay, const std::function<int(int)> &copiesOf) const;
+
+private:
+    static std::vector<Ranked> topK(std::vector<Ranked> &all, size_t k);
+};
+
+// ===== Hold queues =====
+// Per-book waitlists. A queue is ordered by role rank (staff before members),
+// then hold day, then placement order; a per-member index makes placing,
+// cancelling and serving a hold O(log n). Member names must be views that
+// outlive the queues (the Library's pooled names).
+class HoldQueues {
+public:
+    struct Hold {
+        int bookId;
+        std::string_view member;
+        int holdDay;
+    };
+
+private:
+    struct Entry {
+        int rank;
+        int holdDay;
+        uint64_t seq;
+        std::string_view member;
+
+        bool operator<(const Entry &o) const;
+    };
+
+    std::unordered_map<int, std::set<Entry>> byBook;
+    std::unordered_map<std::string_view, std::map<int, Entry>, CaseInsensitiveHash, CaseInsensitiveEqual> byMember;
+    uint64_t nextSeq = 0;
+    size_t count = 0;
+
+public:
+    static int rankOf(std::string_view role);
+    void clear();
+
+    // False if member already holds bookId
+    bool add(int bookId, std::string_view member, int rank, int holdDay);
+
+    bool remove(int bookId, std::string_view member);
+
+    // First in line for bookId
+    bool head(int bookId, Hold &out) const;
+
+    // Drops every hold on bookId (the title was removed)
+    void removeBook(int bookId);
+
+    bool has(int bookId, std::string_view member) const;
+    size_t queued(int bookId) const;
+
+    // 1-based place of member in bookId's queue (0 if not queued); linear in
+    // the number of holds ahead, so only for display
+    size_t position(int bookId, std::string_view member) const;
+
+    std::vector<Hold> ofMember(std::string_view member) const;
+
+    // Every hold in placement order (the order holds.txt is written in)
+    std::vector<Hold> all() const;
+
+    size_t size() const;
+};
+
+// ===== Copy inventory =====
+// One entry per physical copy in a dense array indexed by barcode (assigned
+// sequentially from 1 and never reused). Each title threads its shelved copies
+// into a free list through the entries themselves, so taking or shelving a
+// copy is O(1), and keeps its total/available counts next to the list head.
+class CopyTable {
+public:
+    enum Status : uint8_t { SHELVED, ON_LOAN, WITHDRAWN };
+    static const int32_t NONE = 0;  // "no copy" barcode
+
+    struct Copy {
+        int32_t bookId;
+        int32_t nextFree;   // next shelved copy of the same title, or NONE
+        uint32_t location;  // id in the location pool
+        Status status;
+    };
+
+private:
+    struct Title {
+        int32_t freeHead = NONE;
+        int total = 0;      // copies not withdrawn
+        int available = 0;  // copies on the shelf
+    };
+
+    CowVector<Copy> copies;  // barcode b lives at copies[b - 1]
+    std::unordered_map<int, Title> titles;
+    StringPool locations;
+
+    // For writing; reads go through operator[]
+    Copy& at(int32_t barcode);
+
+    void shelve(Title &title, int32_t barcode);
+
+    // Pops the most recently shelved copy of bookId and gives it status
+    int32_t unshelve(int bookId, Status status);
+
+public:
+    static const char* statusName(Status status);
+    static bool parseStatus(std::string_view text, Status &out);
+    void clear();
+
+    // Appends the next barcode; used for new copies and when loading copies.txt
+    int32_t add(int bookId, std::string_view location, Status status = SHELVED);
+
+    int32_t take(int bookId);
+    int32_t withdraw(int bookId);
+
+    // Puts a copy that was on loan back on the shelf
+    bool release(int32_t barcode);
+
+    // Rebuilds the shelves in barcode order, the order loading copies.txt
+    // produces, so that take() picks the same copies after a restart
+    void reshelve();
+
+    // Forgets the counts of a title whose copies are all withdrawn
+    void dropTitle(int bookId);
+
+    int total(int bookId) const;
+    int available(int bookId) const;
+    size_t size() const;
+    const Copy& operator[](int32_t barcode) const;
+    std::string_view location(const Copy &c) const;
+
+    // Entries (barcode b at b - 1) and location names as of now, for a read view
+    CowVector<Copy> snapshot() const;
+    CowVector<std::string_view> locationSnapshot() const;
+    uint64_t version() const;
+};
+
+// ===== Binary snapshot (library.snap) =====
+// Versioned fixed-layout image of members, books and transactions. Each table
+// is an array of fixed-size records whose text fields are (offset, length)
+// references into one deduplicated string pool, so loading is a mapping plus
+// bounds checks instead of line parsing.
+const char SNAPSHOT_MAGIC[8] = {'L', 'I', 'B', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapString {
+    uint64_t offset;  // into the string pool
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t memberCount, bookCount, transactionCount;
+    uint64_t membersOffset, booksOffset, transactionsOffset;
+    uint64_t poolOffset, poolSize;
+};
+
+struct SnapMember {
+    SnapString name, password, role;
+};
+
+struct SnapBook {
+    int32_t id, totalCopies, availableCopies, reserved;
+    SnapString title, author;
+};
+
+struct SnapTransaction {
+    int32_t bookId, copy;  // copy was reserved (0) before copies were tracked
+    SnapString memberName, issueDate, returnDate;
+};
+
+// Read-only view over a mapped snapshot; fields are only decoded when asked for
+class SnapshotReader {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::string buffer;
+#endif
+
+    const SnapHeader& header() const;
+    bool tableFits(uint64_t offset, uint64_t count, size_t recordSize) const;
+
+public:
+    SnapshotReader() = default;
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    ~SnapshotReader();
+
+    // Maps the file and validates the header; on failure sets error
+    bool open(const std::string &path, std::string &error);
+
+    size_t memberCount() const;
+    size_t bookCount() const;
+    size_t transactionCount() const;
+    const SnapMember& memberAt(size_t i) const;
+    const SnapBook& bookAt(size_t i) const;
+    const SnapTransaction& transactionAt(size_t i) const;
+
+    // Out-of-range references decode as empty rather than reading past the pool
+    std::string_view str(const SnapString &s) const;
+};
+
+// Builds the deduplicated string pool and record tables for a snapshot
+class SnapshotWriter {
+private:
+    std::string pool;
+    std::unordered_map<std::string_view, SnapString> interned;
+
+public:
+    // Views must stay valid until write() returns
+    SnapString add(std::string_view text);
+
+    // Writes header, tables and pool to path (a shadow file; see FileCommit)
+    bool write(const std::string &path, const std::vector<SnapMember> &members, const std::vector<SnapBook> &books,
+               const std::vector<SnapTransaction> &transactions);
+};
+
+// ===== Durable writes =====
+// Written data only survives a crash once it has been fsynced, and a rename
+// only once the directory holding it has been. Windows has no directory
+// sync; _commit is its fsync.
+bool syncPath(const std::string &path, bool directory = false);
+
+std::string parentDirectory(const std::string &path);
+
+// Append-only file for the journal: records go straight to the OS with one
+// write() each and are made durable by sync()
+class AppendOnlyFile {
+private:
+    int fd = -1;
+
+public:
+    ~AppendOnlyFile();
+    bool open(const std::string &path, bool truncate);
+    bool append(const std::string &data);
+    bool sync();
+    void close();
+};
+
+// Replaces a set of files as one atomic unit. The caller writes each file's
+// new contents to its shadow ("<file>.new"); prepare() fsyncs the shadows and
+// then atomically creates the manifest naming them, which is the commit
+// point. install() renames the shadows over the live files and finish()
+// removes the manifest. After a crash, recover() rolls a committed set
+// forward or discards an uncommitted one, so readers never see a mix.
+// Files may sit in subdirectories of the manifest's directory as long as
+// their names are unique; the manifest records names only.
+class FileCommit {
+private:
+    std::string manifest;
+    std::vector<std::string> files;
+
+    static std::string shadowOf(const std::string &file);
+
+    // Every directory holding a staged file, the manifest's own last
+    bool syncDirectories() const;
+
+public:
+    explicit FileCommit(const std::string &manifestPath);
+
+    // Registers file as part of this commit; returns where to write its contents
+    std::string stage(const std::string &file);
+
+    bool prepare();
+    bool install();
+    void finish();
+
+    // Backs out a commit whose prepare() failed; the live files are untouched
+    void abort();
+
+    // Completes or discards a commit interrupted by a crash. candidates are the
+    // files a commit may cover. Returns true if a committed set was installed
+    // (finish() must follow once dependent state such as the journal is reset).
+    bool recover(const std::vector<std::string> &candidates);
+};
+
+// ===== Metrics =====
+// Call counts and latency histograms for the hot paths. Buckets are powers of
+// two in microseconds and are updated with relaxed atomics, so server threads
+// record without locking; Metrics::Scope times the block it is declared in.
+enum MetricOp {
+    OP_LOAD_MEMBERS, OP_LOAD_BOOKS, OP_LOAD_TRANSACTIONS, OP_LOAD_HOLDS, OP_LOAD_COPIES, OP_LOAD_SNAPSHOT,
+    OP_LOAD_ARCHIVE,
+    OP_SAVE_MEMBERS, OP_SAVE_BOOKS, OP_SAVE_TRANSACTIONS, OP_SAVE_HOLDS, OP_SAVE_COPIES, OP_SAVE_SNAPSHOT,
+    OP_SAVE_ARCHIVE,
+    OP_COMMIT, OP_PERSIST, OP_SEARCH, OP_ISSUE, OP_RETURN, OP_LOGIN,
+    METRIC_OPS
+};
+
+// Export labels per MetricOp: operation and, for loads/saves, the file
+const std::pair<const char*, const char*> METRIC_LABELS[METRIC_OPS] = {
+    {"load", "members.txt"}, {"load", "books.txt"}, {"load", "transactions.txt"},
+    {"load", "holds.txt"}, {"load", "copies.txt"}, {"load", "library.snap"}, {"load", "archive"},
+    {"save", "members.txt"}, {"save", "books.txt"}, {"save", "transactions.txt"},
+    {"save", "holds.txt"}, {"save", "copies.txt"}, {"save", "library.snap"}, {"save", "archive"},
+    {"commit", ""}, {"persist", ""}, {"search", ""}, {"issue", ""}, {"return", ""}, {"login", ""},
+};
+
+#if LIBRARY_METRICS
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 26;  // <= 1us, <= 2us, ... <= 2^24us (about 17 s), then +Inf
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> calls{0}, totalNanos{0}, maxNanos{0};
+
+public:
+    void record(uint64_t nanos);
+
+    // Upper bound of a bucket in microseconds (infinity for the last)
+    static double bound(int bucket);
+
+    uint64_t count() const;
+    uint64_t inBucket(int bucket) const;
+    double seconds() const;
+    double maxMicros() const;
+
+    // Upper bound of the bucket holding quantile q, capped at the maximum seen
+    double quantileMicros(double q) const;
+};
+
+class Metrics {
+public:
+    static LatencyHistogram& of(MetricOp op);
+
+    class Scope {
+    private:
+        MetricOp op;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    public:
+        explicit Scope(MetricOp op);
+        ~Scope();
+    };
+};
+#endif
+
+// ===== Loan archive =====
+// Cold storage for closed loans. Loans returned before the archive horizon
+// leave the live history and are written once into immutable segment files
+// (archive/loans-YYYY-MM[.N].seg) partitioned by return month. A segment is
+// a fixed header followed by a compressed payload: the borrower names it
+// uses, then per loan five varints holding the return day delta, loan length,
+// book id delta, copy and name index. Startup reads only the headers; a
+// segment's loans are decoded when a query reaches its date range, and the
+// last few decoded segments stay cached.
+const char ARCHIVE_MAGIC[8] = {'L', 'I', 'B', 'A', 'R', 'C', 'H', '\0'};
+const uint32_t ARCHIVE_VERSION = 1;
+
+struct ArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t month;       // return month (monthOfDay) of every loan in the segment
+    int32_t sequence;    // 1 for the month's first segment, then 2, 3, ...
+    int32_t firstIssueDay, lastIssueDay;
+    int32_t firstReturnDay, lastReturnDay;
+    uint64_t loanCount;
+    uint64_t payloadSize;
+    uint64_t checksum;   // FNV-1a over the payload
+};
+
+class LoanArchive {
+public:
+    struct Segment {
+        std::string path;
+        ArchiveHeader header;
+        bool counted;    // already part of the owner's CirculationStats
+    };
+
+private:
+    static const size_t CACHED_SEGMENTS = 8;
+
+    std::string dir;
+    std::vector<Segment> segments;  // by month, then sequence
+
+    // Decoded segments by path, most recently used last. Queries run under
+    // the owner's read lock, so the cache and the name pool its records
+    // point into have a lock of their own.
+    mutable std::mutex cacheMutex;
+    mutable std::vector<std::pair<std::string, std::shared_ptr<const std::vector<LoanRecord>>>> cache;
+    mutable StringPool names;
+
+    static void putVarint(std::string &out, uint64_t v);
+    static bool getVarint(std::string_view data, size_t &pos, uint64_t &v);
+    static uint64_t zigzag(int64_t v);
+    static int64_t unzigzag(uint64_t v);
+    static uint64_t checksum(std::string_view data);
+    static bool before(const Segment &a, const Segment &b);
+
+    // A damaged segment decodes as empty; open() has already checked its size
+    std::shared_ptr<const std::vector<LoanRecord>> load(const Segment &s) const;
+
+    bool decode(std::string_view payload, uint64_t count, std::vector<LoanRecord> &out) const;
+
+public:
+    // Reads the segment headers under directory; returns a description of
+    // any segments that had to be skipped, or ""
+    std::string open(const std::string &directory);
+
+    // Live files with a shadow left behind by an interrupted commit, for FileCommit::recover
+    static std::vector<std::string> pendingFiles(const std::string &directory);
+
+    // Where the next segment for month goes; segments are never rewritten
+    std::string nextPath(int month, int &sequence) const;
+
+    // Encodes loans (all returned in month) into a segment file at path
+    static bool write(const std::string &path, int month, int sequence, const std::vector<LoanRecord> &loans,
+                      ArchiveHeader &h);
+
+    // Registers a segment written by write() once its commit is installed
+    void add(const std::string &path, const ArchiveHeader &header, bool counted);
+
+    // Calls fn for every archived loan issued (or, with byReturn, returned)
+    // from fromDay to toDay inclusive; segments outside the range are not read
+    void forEach(int fromDay, int toDay, bool byReturn, const std::function<void(const LoanRecord&)> &fn) const;
+
+    // As above over a copy of all() taken earlier (by a read view). Segments
+    // are never modified, and loading them is safe from any thread.
+    void forEach(const std::vector<Segment> &from, int fromDay, int toDay, bool byReturn,
+                 const std::function<void(const LoanRecord&)> &fn) const;
+
+    // Calls fn for the loans of every segment not yet counted, then marks them counted
+    void countNew(const std::function<void(const LoanRecord&)> &fn);
+
+    const std::vector<Segment>& all() const;
+    size_t loanCount() const;
+};
+
+// ===== Bulk transfer files =====
+// Exchange format for moving a whole library in or out: one file per table,
+// CSV with a header row or JSON Lines with one flat object per row.
+enum class BulkFormat { CSV, JSON_LINES };
+
+// Streams the rows of one export file through a buffer flushed in large
+// writes. Fields are given in the order of the columns passed in.
+class BulkWriter {
+private:
+    static const size_t FLUSH_BYTES = 1 << 20;
+
+    std::ofstream file;
+    std::vector<std::string> columns;
+    bool json;
+    std::string buffer;
+    size_t field = 0;  // next column of the current row
+    size_t rows = 0;
+
+    void separate();
+
+public:
+    BulkWriter(const std::string &path, const std::vector<std::string> &columnNames, BulkFormat format);
+    BulkWriter& text(std::string_view s);
+    BulkWriter& number(long long n);
+    void endRow();
+
+    // Writes out what is buffered; false if the file could not be written
+    bool close();
+
+    size_t rowCount() const;
+};
+
+// ===== Operation results =====
+// Every mutating operation reports an error code for programs and a message
+// for people; a default-constructed result is success.
+enum class LibraryError {
+    NONE,
+    INVALID_INPUT,      // missing field, bad count, role or date
+    BOOK_NOT_FOUND,
+    BOOK_EXISTS,
+    MEMBER_NOT_FOUND,
+    MEMBER_EXISTS,
+    NO_COPY_AVAILABLE,
+    COPIES_AVAILABLE,   // holds are only placed when every copy is out
+    RESERVED,           // the next copy belongs to the head of the hold queue
+    COPIES_ON_LOAN,     // the change would remove copies that are issued
+    NOT_ON_LOAN,
+    ALREADY_ON_LOAN,
+    ALREADY_HELD,
+    NOT_HELD,
+    BAD_CREDENTIALS,
+    SAVE_FAILED,        // applied in memory, but the files could not be rewritten
+};
+
+struct Result {
+    LibraryError error = LibraryError::NONE;
+    std::string message;
+
+    bool ok() const;
+};
+
+struct IssueResult : Result {
+    int32_t copy = 0;  // barcode of the copy lent
+};
+
+struct ReturnResult : Result {
+    int32_t copy = 0;
+    int lateDays = 0;
+    int fine = 0;
+    std::string servedHold;  // member the copy was issued on to, "" if no one was waiting
+};
+
+struct DeleteResult : Result {
+    int remaining = 0;  // copies left; 0 means the book record was removed
+};
+
+struct LoginResult : Result {
+    std::string name;  // as stored, whatever case it was typed in
+    std::string role;
+};
+
+struct MigrateResult : Result {
+    size_t migrated = 0;  // plaintext passwords hashed
+};
+
+// Rows moved per file by a bulk export or import and the time each took
+struct TransferResult : Result {
+    struct Table {
+        std::string file;
+        size_t rows = 0;
+        double seconds = 0;
+    };
+    std::vector<Table> tables;
+    std::vector<std::string> problems;  // "file:line: message" for each row an import rejected
+    double seconds = 0;       // whole transfer, the final commit included
+};
+
+// ===== Read views =====
+// The run of index (loan slots sorted by day) whose days fall in
+// [fromDay, toDay]: two binary searches
+template <typename DayOf>
+std::pair<CowVector<size_t>::const_iterator, CowVector<size_t>::const_iterator>
+dayRange(const CowVector<size_t> &index, int fromDay, int toDay, DayOf dayOf) {
+    auto first = std::lower_bound(index.begin(), index.end(), fromDay, [&](size_t s, int d) { return dayOf(s) < d; });
+    auto last = std::upper_bound(first, index.end(), toDay, [&](int d, size_t s) { return d < dayOf(s); });
+    return {first, last};
+}
+
+// Point-in-time image of the books, members, copies and loans (live and archived)
+// for reads long enough to hold up circulation if they ran under the lock
+// (full listings, date-range reports, exports). It shares the Library's
+// chunks until they are written, is read without any lock and never
+// changes afterwards. Like the records it hands out, it is only valid
+// while its Library exists.
+class LibraryView {
+private:
+    CowVector<Book> bookTable;
+    CowVector<Member> memberTable;
+    CowVector<Transaction> loanTable;
+    CowVector<CopyTable::Copy> copyEntries;  // barcode b at b - 1
+    CowVector<std::string_view> memberNames, locationNames;
+    CowVector<size_t> issueOrder, returnOrder;  // slots in loanTable by issue / return day
+
+    // The archive's segment list as of the view; the archive itself only
+    // ever adds segments, and reads them under its own lock
+    std::vector<LoanArchive::Segment> segments;
+    const LoanArchive* archive;
+
+    // Per-title (available, total) copies, tallied from copyEntries on first use
+    mutable std::once_flag tallied;
+    mutable std::unordered_map<int, std::pair<int, int>> counts;
+
+    const std::pair<int, int>& countsOf(int id) const;
+    std::vector<size_t> loanSlotsBetween(int fromDay, int toDay, DateField field) const;
+
+public:
+    LibraryView(CowVector<Book> books, CowVector<Member> members, CowVector<Transaction> loans,
+                CowVector<CopyTable::Copy> copies, CowVector<std::string_view> names,
+                CowVector<std::string_view> locations, CowVector<size_t> byIssueDay, CowVector<size_t> byReturnDay,
+                std::vector<LoanArchive::Segment> archived, const LoanArchive &from);
+    const CowVector<Book>& books() const;
+    const CowVector<Member>& members() const;
+
+    // Live (not archived) loans in recorded order
+    const CowVector<Transaction>& transactions() const;
+    std::string_view memberOf(const Transaction &t) const;
+    int availableCopies(int id) const;
+    int totalCopies(int id) const;
+    size_t copyCount() const;
+    const CopyTable::Copy& copy(int32_t barcode) const;
+    std::string_view location(const CopyTable::Copy &c) const;
+    LoanRecord record(const Transaction &t) const;
+    static TransactionView view(const LoanRecord &l);
+
+    // Live and archived loans issued (or returned) from fromDay to toDay
+    // inclusive, in recorded order with the archived ones first. Segments
+    // split the archive by return month, so its loans are put back in issue
+    // order (the order they were recorded in). Only the archive segments
+    // overlapping the range are read.
+    std::vector<LoanRecord> loanHistory(int fromDay, int toDay, DateField field) const;
+
+    // As loanHistory, in date order
+    std::vector<TransactionView> loansBetween(int fromDay, int toDay, DateField field) const;
+};
+
+// ===== Library class =====
+class Library {
+private:
+    // Chunked copy-on-write, so that readView() can freeze them cheaply
+    CowVector<Member> members;
+    CowVector<Book> books;
+    CowVector<Transaction> transactions;
+
+    // Backing storage for the records' text. Only ever appended to, so the
+    // views held by records and index keys stay valid.
+    StringPool names;    // member names, shared by members and transactions
+    StringPool authors;
+    StringArena titles;
+
+    std::string membersFile = "members.txt";
+    std::string booksFile = "books.txt";
+    std::string transactionsFile = "transactions.txt";
+    std::string holdsFile = "holds.txt";
+    std::string copiesFile = "copies.txt";
+    std::string journalFile = "journal.log";
+    std::string snapshotFile = "library.snap";
+    std::string manifestFile = "commit.manifest";  // present only while a commit is in flight
+    std::string archiveDir = "archive";
+
+    // When set, library.snap is the snapshot and the text files are not written
+    bool binarySnapshot = false;
+
+    // Write-ahead journal: each mutation is appended as one record and the
+    // snapshot files above are only rewritten when the journal is compacted.
+    enum DirtyFlags { DIRTY_MEMBERS = 1, DIRTY_BOOKS = 2, DIRTY_TRANSACTIONS = 4, DIRTY_HOLDS = 8 };
+    static const int DIRTY_ALL = DIRTY_MEMBERS | DIRTY_BOOKS | DIRTY_TRANSACTIONS | DIRTY_HOLDS;
+    bool journalMode;
+    size_t compactThreshold;  // records before the journal is folded into the snapshot
+    size_t journalRecords = 0;
+    AppendOnlyFile journal;
+    // Set when an append failed and may have left part of a record behind;
+    // until the journal is next truncated, changes are saved by compacting
+    bool journalTorn = false;
+    // Set when a commit reached its manifest but its files could not all be
+    // renamed into place; the journal and manifest are left for recover()
+    bool commitStranded = false;
+
+    // Group commit: a record is durable once the journal has been fsynced
+    // after it. When groupCommit is set, persist() only appends and callers
+    // wait in waitDurable() outside their own locks, so concurrent writers
+    // share one fsync; otherwise every persist() syncs before returning.
+    bool groupCommit = false;
+    std::atomic<uint64_t> appendedRecords{0};
+    uint64_t durableRecords = 0;  // guarded by syncMutex
+    uint64_t failedRecords = 0;   // records up to here were covered by a failed sync (syncMutex)
+    bool syncing = false;         // a leader is inside journal.sync()
+    std::mutex syncMutex;
+    std::condition_variable journalSynced;
+
+    // PBKDF2 cost for newly hashed passwords; older hashes are upgraded on login
+    uint32_t kdfIterations = DEFAULT_KDF_ITERATIONS;
+    // Highest cost among the stored hashes (0 = none yet). Unknown names are
+    // checked at this cost, so they take as long as the slowest known one.
+    uint32_t storedIterations = 0;
+
+    // Set while a batch run is in progress: mutations are not persisted one by
+    // one, the batch driver compacts instead.
+    bool deferPersist = false;
+
+    // Problem found while loading (e.g. an unreadable library.snap), for the front end to show
+    std::string loadWarning;
+
+    // Point-lookup indexes: book id -> slot in books, member name -> slot in members.
+    // Member names are keyed case-insensitively, matching how login/issue compare them.
+    std::unordered_map<int, size_t> bookIndex;
+    std::unordered_map<std::string_view, size_t, CaseInsensitiveHash, CaseInsensitiveEqual> memberIndex;
+
+    // Outstanding loans (no return date yet) as slots in transactions, in issue
+    // order, keyed by member and by book. Returns and "my borrowed books" only
+    // touch these lists, never the full history.
+    std::unordered_map<std::string_view, std::vector<size_t>, CaseInsensitiveHash, CaseInsensitiveEqual>
+        openLoansByMember;
+    std::unordered_map<int, std::vector<size_t>> openLoansByBook;
+
+    // Open loans bucketed by due day (issue day + loan period), so an overdue
+    // report only visits the buckets that fall before the report date
+    std::map<int, std::vector<size_t>> openLoansByDueDay;
+
+    // Every loan as a slot in transactions, sorted by issue day, and every
+    // returned loan sorted by return day (ties in recorded order). A date
+    // range is then two binary searches and a contiguous run. Loans nearly
+    // always arrive in date order, so keeping these sorted is an append.
+    // Chunked like transactions, so read views answer date ranges too.
+    CowVector<size_t> loansByIssueDay, loansByReturnDay;
+
+    // Tokenized, case-folded titles and authors for searchBook
+    SearchIndex searchIndex;
+
+    // Incremental circulation aggregates for the analytics dashboard
+    CirculationStats stats;
+
+    // Waitlists for books with no copy on the shelf (persisted in holds.txt)
+    HoldQueues holds;
+
+    // Physical copies by barcode (persisted in copies.txt). Data saved before
+    // copies were tracked gets them synthesized from the per-title counts.
+    CopyTable copies;
+    bool copiesLoaded = false;
+
+    // Latest read view and the table versions it was taken at; reused until
+    // a table it covers changes. Readers share the caller's read lock, so
+    // building one is serialized by viewMutex.
+    mutable std::mutex viewMutex;
+    mutable std::shared_ptr<const LibraryView> currentView;
+    mutable uint64_t viewVersion = 0;
+
+    // Closed loans returned before the horizon (in days before today, 0 = keep
+    // everything live) move out of transactions into the archive at commit
+    // time, so the live history and every rewrite of it stay bounded
+    LoanArchive archive;
+    int archiveHorizon = 0;
+
+    // ---- Index maintenance ----
+    // Re-point index entries for books[from..] (after an erase shifts the tail)
+    void reindexBooksFrom(size_t from);
+
+    static int dueDayOf(const Transaction &t);
+    void indexOpenLoan(size_t slot);
+
+    template <typename Map, typename Key>
+    static void dropLoanSlot(Map &index, const Key &key, size_t slot) {
+        auto it = index.find(key);
+        if (it == index.end()) return;
+        auto &slots = it->second;
+        slots.erase(std::find(slots.begin(), slots.end(), slot));
+        if (slots.empty()) index.erase(it);
+    }
+
+    void unindexOpenLoan(size_t slot);
+    void rebuildOpenLoans();
+
+    // Slot of the open loan of book id to member, transactions.size() if none
+    size_t openLoanSlot(int id, const std::string &member) const;
+
+    // Inserts slot after every entry with a day <= its own
+    template <typename DayOf>
+    static void insertByDay(CowVector<size_t> &index, size_t slot, DayOf dayOf) {
+        int day = dayOf(slot);
+        if (index.empty() || dayOf(index.back()) <= day) {
+            index.push_back(slot);
+            return;
+        }
+        auto at = std::upper_bound(index.begin(), index.end(), day, [&](int d, size_t s) { return d < dayOf(s); });
+        index.insert(at - index.begin(), slot);
+    }
+
+    int issueDayAt(size_t slot) const;
+    int returnDayAt(size_t slot) const;
+    void indexIssueDay(size_t slot);
+    void indexReturnDay(size_t slot);
+    void rebuildDateIndexes();
+    void rebuildSearchIndex();
+    const Book* findBook(int id) const;
+
+    // ---- State mutations (shared by the interactive ops and journal replay) ----
+    bool applyAddMember(const std::string &name, const std::string &pass, const std::string &role);
+
+    bool applySetPassword(const std::string &name, const std::string &hash);
+    void noteCredential(const std::string &stored);
+    bool applyAddBook(int id, const std::string &title, const std::string &author, int count,
+                      const std::string &location);
+
+    // New copies go to the default location; copies are withdrawn from the shelf
+    bool applyUpdateBook(int id, const std::string &title, const std::string &author, int total);
+
+    // Withdraws shelved copies; the record is dropped once no copies remain
+    bool applyDeleteCopies(int id, int count);
+
+    bool applyIssue(int id, const std::string &member, const std::string &date);
+    bool applyPlaceHold(int id, const std::string &member, const std::string &date);
+
+    // Closes the open loan for (id, member); returns it, or nullptr if none.
+    // The freed copy goes straight to the head of the book's hold queue, if
+    // any, as a new loan on the same date; *servedHold receives that member.
+    const Transaction* applyReturn(int id, const std::string &member, const std::string &date,
+                                   std::string* servedHold = nullptr);
+
+    // ---- Journal ----
+    void openJournal(bool truncate);
+
+    void applyJournalRecord(const std::vector<std::string> &f);
+
+    // Re-apply mutations recorded since the last compaction
+    void replayJournal();
+
+    // Persist one mutation. In journal mode only the record is appended;
+    // otherwise the affected snapshot files are rewritten in full. False if
+    // the record could not be written or synced, or the files could not be
+    // rewritten (a failed compaction keeps the journal). With group commit
+    // the sync happens later, in waitDurable().
+    bool persist(const std::vector<std::string> &record, int dirty);
+
+    template <typename R = Result>
+    static R failure(LibraryError error, const std::string &message) {
+        R r;
+        r.error = error;
+        r.message = message;
+        return r;
+    }
+
+    // Result for a change that is applied but could not be written out
+    template <typename R = Result>
+    R persisted(const std::vector<std::string> &record, int dirty, R r = R()) {
+        if (!persist(record, dirty)) {
+            r.error = LibraryError::SAVE_FAILED;
+            r.message = "could not save library data";
+        }
+        return r;
+    }
+
+    // ---- Archiving ----
+    // Slots of the closed loans returned before the first of the month holding
+    // today - archiveHorizon, in recorded order. Cutting at a month boundary
+    // means a month is normally archived once, as a single segment.
+    std::vector<size_t> archivableLoans() const;
+
+    struct StagedSegment {
+        std::string path;
+        ArchiveHeader header;
+    };
+
+    // Writes one new segment per return month into the commit
+    bool stageArchive(const std::vector<size_t> &slots, FileCommit &commit, std::vector<StagedSegment> &staged);
+
+    // Drops loans that are now in the archive and re-derives the slot indexes
+    void dropArchivedLoans(const std::vector<bool> &archived);
+
+    // Rewrites the snapshot files named in dirty (library.snap alone in binary
+    // mode) as one atomic commit and starts an empty journal. Loans due for
+    // the archive go into new segments in the same commit. On failure the
+    // live files and the journal are left as they were.
+    bool commitFiles(int dirty);
+
+    // ---- Bulk transfer ----
+    // Reads dir/<table>.csv, or failing that dir/<table>.jsonl, into buffer
+    // and calls row(line, values) for each record, values[i] holding columns[i]
+    // ("" when the record leaves it out) as a view into buffer. A message
+    // row returns becomes a "file:line: message" problem. The first required
+    // columns must be in a CSV header. Returns the file name, "" if neither exists.
+    static std::string readBulkTable(
+        const std::string &dir, const std::string &table, const std::vector<std::string> &columns, size_t required,
+        std::string &buffer, std::vector<std::string> &problems,
+        const std::function<std::string(size_t, const std::vector<std::string_view>&)> &row);
+
+public:
+    // dataDir (if given) holds all data files instead of the working directory
+    Library(bool journaled = true, size_t compactEvery = 1000, const std::string &dataDir = "");
+
+    // Fold the journal into the snapshot and start an empty journal; false
+    // if the files could not be written (the journal is kept)
+    bool compact();
+
+    // Compacts if anything has been journaled since the last compaction
+    bool flush();
+
+    // While set, changes stay in memory until the caller compacts (bulk runs)
+    void setDeferPersist(bool deferred);
+
+    // Set when loading fell back from a damaged library.snap or skipped a
+    // damaged archive segment, "" otherwise
+    const std::string& warning() const;
+
+    // ---- Archive ----
+    // Closed loans returned more than days ago (rounded back to the start of
+    // that month) leave the live history at the next commit; 0 disables
+    void setArchiveHorizon(int days);
+
+    // Archives whatever is due now instead of at the next commit; returns
+    // how many loans moved (0 if none were due or the commit failed)
+    size_t archiveClosedLoans();
+
+    const std::vector<LoanArchive::Segment>& archiveSegments() const;
+    size_t archivedLoanCount() const;
+
+    // ---- Group commit ----
+    void setGroupCommit(bool enabled);
+
+    // Number of journal records appended so far; pass to waitDurable()
+    uint64_t journalSequence() const;
+
+    // Blocks until record seq is on disk. The first waiter syncs everything
+    // appended so far; waiters that arrive meanwhile are covered by its sync
+    // or the next one. False if the sync covering seq failed: every waiter
+    // in that batch gets the failure and the records never count as durable.
+    bool waitDurable(uint64_t seq);
+
+    // Switch persistence to library.snap (converting the loaded text data)
+    bool convertToSnapshot();
+
+    // Switch persistence back to the text files and drop library.snap
+    bool convertToText();
+
+    // ---- Operations ----
+    // Each validates its input, applies the change and persists it. Nothing
+    // is changed unless the result is ok() (or SAVE_FAILED: applied in memory
+    // but not written out).
+
+    // The copies are shelved at location ("" = the default location)
+    Result addBook(int id, const std::string &title, const std::string &author, int count,
+                   const std::string &location = "");
+
+    // Empty title or author keeps the current one; so does a negative total.
+    // Added copies go to the default location, removed ones come off the shelf.
+    Result updateBook(int id, const std::string &title, const std::string &author, int total);
+
+    // Withdraws count shelved copies; issued copies cannot be deleted
+    DeleteResult deleteCopies(int id, int count);
+
+    Result addMember(const std::string &name, const std::string &pass, const std::string &roleText);
+    IssueResult issueBook(int id, const std::string &member, const std::string &date);
+
+    // The returned copy goes straight to the first member waiting for the
+    // book, if any (r.servedHold). A date before the issue date is rejected.
+    ReturnResult returnBook(int id, const std::string &member, const std::string &date);
+
+    // Queues member for a book with no copy on the shelf
+    Result placeHold(int id, const std::string &member, const std::string &date);
+
+    Result cancelHold(int id, const std::string &member);
+
+    // authenticate() plus the lazy re-hash of an outdated credential. Server
+    // threads call the two halves themselves so logins can share a read lock.
+    // SAVE_FAILED (with name and role set) if the new hash was not written out.
+    LoginResult login(const std::string &name, const std::string &pass);
+
+    // ---- Bulk transfer ----
+    // Writes books, members and the whole loan history (archived loans
+    // first) to dir as <table>.csv or <table>.jsonl. Members carry their
+    // stored credential; a book's location is where its first copy is
+    // shelved. Copy barcodes stay in copies.txt and are not exported.
+    // Everything is read from one readView(), so the tables agree with each
+    // other even when writers carry on while they are being written.
+    TransferResult exportTo(const std::string &dir, BulkFormat format) const;
+
+    // Loads what exportTo writes (or any files of the same shape) into an
+    // empty library. Each file is read once and every row checked as it is
+    // parsed: numbers, dates and roles, duplicate ids and names, loans of
+    // unknown books or members, loans returned before they were issued, more
+    // open loans than copies, and available counts that disagree with the
+    // open loans. Nothing is applied unless every row passes (r.problems
+    // lists the ones that did not); then the whole library is committed at
+    // once. Passwords are taken as stored credentials, so plaintext ones are
+    // hashed on login or by migratePasswords(). Imported loans get copies anew.
+    TransferResult importFrom(const std::string &dir);
+
+    // ---- Read views ----
+    // Consistent point-in-time view of the books, members, copies and loans,
+    // live and archived. Take it under the same lock as any other read; it
+    // can then be read without one while writers carry on. Views are shared
+    // until a table they cover changes, and taking a new one is a pointer
+    // copy per chunk (and a copy of the archive's short segment list).
+    std::shared_ptr<const LibraryView> readView() const;
+
+    // ---- Read-only queries ----
+    const CowVector<Book>& allBooks() const;
+    const CowVector<Member>& allMembers() const;
+
+    // The live (not archived) loans in recorded order; memberOf() names the borrower
+    const CowVector<Transaction>& allTransactions() const;
+    std::string_view memberOf(const Transaction &t) const;
+    const Book* getBook(int id) const;
+    const Member* getMember(std::string_view name) const;
+
+    static const size_t FUZZY_RESULTS = 20;
+
+    // Ranked keyword matches. When nothing matches as typed and approximate is
+    // given, falls back to the FUZZY_RESULTS best typo-tolerant matches and
+    // sets *approximate.
+    std::vector<SearchIndex::Hit> search(const std::string &keywords, uint8_t fields = SearchIndex::FIELD_ANY,
+                                         bool* approximate = nullptr) const;
+
+    // Verifies against the single record found through the name index. Unknown
+    // names still pay for one KDF run so response time does not reveal them.
+    const Member* authenticate(const std::string &name, const std::string &pass) const;
+
+    // True for plaintext entries and hashes made with a different KDF cost
+    bool needsRehash(const Member &m) const;
+
+    // Re-hashes a verified password with the current cost (lazy migration)
+    Result upgradeCredential(const std::string &name, const std::string &pass);
+
+    // Hashes every remaining plaintext password and rewrites the snapshot
+    MigrateResult migratePasswords();
+
+    void setKdfIterations(uint32_t iterations);
+    TransactionView view(const Transaction &t) const;
+    static TransactionView view(const LoanRecord &l);
+    LoanRecord record(const Transaction &t) const;
+    std::vector<TransactionView> openLoans(const std::string &member) const;
+
+    // ---- Date ranges ----
+    // Live and archived loans issued (or returned) from fromDay to toDay
+    // inclusive, in recorded order with the archived ones first (see
+    // LibraryView::loanHistory). Long reports should take readView() and
+    // query that outside the lock instead.
+    std::vector<LoanRecord> loanHistory(int fromDay, int toDay, DateField field) const;
+
+    // As loanHistory, in date order
+    std::vector<TransactionView> loansBetween(int fromDay, int toDay, DateField field) const;
+
+    // ---- Copies ----
+    static constexpr const char* DEFAULT_LOCATION = "Main";  // shelf for copies added without one
+    int totalCopies(int id) const;
+    int availableCopies(int id) const;
+    const CopyTable& copyTable() const;
+
+    // ---- Holds ----
+    // Member first in line for book id, or ""
+    std::string holdHead(int id) const;
+
+    std::vector<HoldQueues::Hold> holdsOf(const std::string &member) const;
+    size_t holdPosition(int id, const std::string &member) const;
+    size_t holdsQueued(int id) const;
+
+    // ---- Overdue loans and fines ----
+    struct OverdueLoan {
+        int bookId;
+        std::string memberName;
+        std::string issueDate;
+        int dueDay;
+        int lateDays;
+        int fine;
+    };
+
+    // Open loans past their due day as of asOfDay, most overdue first
+    std::vector<OverdueLoan> overdueAsOf(int asOfDay) const;
+
+    struct FineTotals {
+        size_t loans = 0, lateLoans = 0;
+        long long fines = 0;
+    };
+
+    // One pass over every loan, archived ones included: fines charged on
+    // returned loans plus fines accrued on open loans as of asOfDay. Writes a
+    // CSV row per late loan.
+    FineTotals computeFines(int asOfDay, std::ostream &csv) const;
+
+    // Archived loans are folded in the first time the stats are asked for
+    // (that is when their segments are read), live ones as they happen
+    const CirculationStats& circulationStats();
+
+    size_t memberCount() const;
+    size_t bookCount() const;
+    size_t transactionCount() const;
+
+    // ---- Metrics ----
+    std::vector<std::pair<const char*, size_t>> recordCounts() const;
+
+    // Record counts and (unless compiled out) the latency histograms, as
+    // Prometheus text exposition format or as JSON
+    std::string metricsReport(bool json) const;
+
+    // JSON when path ends in ".json", Prometheus text otherwise
+    bool writeMetrics(const std::string &path) const;
+
+private:
+    // ---- File I/O ----
+    void loadMembers();
+
+    bool saveMembers(const std::string &path);
+    void loadBooks();
+    bool saveBooks(const std::string &path);
+
+    // Loads members.txt and books.txt on their own threads while
+    // transactions.txt is parsed; the loans are merged once both are in
+    void loadTextFiles();
+
+    // One slice of transactions.txt, parsed on its own thread. Member names
+    // get local ids in order of first appearance and are interned at merge.
+    struct ParsedChunk {
+        std::vector<Transaction> loans;
+        std::vector<std::string_view> memberNames;  // local id -> name (views into the file buffer)
+        bool malformed = false;           // stopped at a record without a numeric book id
+    };
+
+    // Offsets splitting data into up to parts slices that each start on a
+    // record (every 4th line). Newlines are counted in parallel first so each
+    // cut can tell which line it lands on.
+    static std::vector<size_t> recordBoundaries(std::string_view data, size_t parts);
+
+    // Records are "bookId[ barcode]", member, issue date, return date ("" while
+    // out); the barcode is missing in files written before copies were tracked
+    static void parseTransactionChunk(std::string_view text, ParsedChunk &out);
+
+    // Reads transactions.txt in one call and parses it in parallel slices.
+    // beforeMerge runs before anything shared is touched: the name pool and,
+    // for data saved before copies were tracked, the copy table.
+    void loadTransactions(const std::function<void()> &beforeMerge = [] {});
+
+    // Leaves out the slots set in archived (loans moving to the archive)
+    bool saveTransactions(const std::string &path, const std::vector<bool> &archived);
+
+    // Needs members loaded first: a hold's priority comes from its member's role
+    void loadHolds();
+
+    bool saveHolds(const std::string &path);
+
+    // Returns false if there is no copies.txt yet (data from before copies were tracked)
+    bool loadCopies();
+
+    bool saveCopies(const std::string &path);
+
+    // Gives a title loaded without copies.txt its copies; open loans then take
+    // them in issue order as the transactions are loaded
+    void synthesizeCopies(int id, int total);
+
+    // Loads library.snap if present; returns false to fall back to the text files
+    bool loadSnapshot();
+
+    bool saveSnapshot(const std::string &path, const std::vector<bool> &archived);
+};
+
+
+// ===== Branches =====
+// The catalog and circulation of each branch live in their own Library (own
+// directory, files, journal and lock), so issues and returns at one branch
+// never wait on another. Cross-branch queries fan out to every branch on its
+// own thread under that branch's read lock and merge the answers.
+class BranchCatalog {
+public:
+    struct Branch {
+        std::string name;
+        std::unique_ptr<Library> lib;
+        mutable std::shared_mutex lock;  // shared for reads, exclusive for changes
+    };
+
+    struct BranchHit {
+        size_t branch;
+        int bookId;
+        int score;
+        std::string title, author;
+        int available, total;
+    };
+
+    struct BranchStock {
+        size_t branch;
+        int available, total;
+    };
+
+private:
+    std::vector<std::unique_ptr<Branch>> branches;
+
+    // Runs fn(i) for every branch, each on its own thread (the last on the caller's)
+    template <typename F>
+    void forEachBranch(F fn) const {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i + 1 < branches.size(); ++i) workers.emplace_back([&fn, i] { fn(i); });
+        if (!branches.empty()) fn(branches.size() - 1);
+        for (auto &t : workers) t.join();
+    }
+
+public:
+    // One branch per (name, data directory); directories are created as
+    // needed and the branches are loaded in parallel
+    BranchCatalog(const std::vector<std::pair<std::string, std::string>> &dirs, bool journaled = true,
+                  size_t compactEvery = 1000);
+    size_t size() const;
+    Branch& operator[](size_t i);
+    const Branch& operator[](size_t i) const;
+
+    // Index of the branch called name (case-insensitive), or size() if none
+    size_t find(std::string_view name) const;
+
+    // Keyword search across every branch, best score first (ties in branch
+    // order). Typo-tolerant matches only count when no branch has an exact
+    // one; *approximate tells which kind was returned.
+    std::vector<BranchHit> search(const std::string &keywords, bool* approximate = nullptr) const;
+
+    // Copies of book id at each branch that has it, in branch order
+    std::vector<BranchStock> availability(int id) const;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// Closed loans moved to archive segments and read back
+#include "library_core.h"
+#include "test_util.h"
+
+#include <tuple>
+
+using namespace std;
+
+typedef tuple<int, int, string, string, string> Loan;  // book, copy, member, issued, returned
+
+// Every loan, live and archived, in a stable order for comparing
+static vector<Loan> history(const Library &lib) {
+    vector<Loan> loans;
+    for (auto &t : lib.loansBetween(parseDay("2000-01-01"), parseDay("2099-12-31"), BY_ISSUE_DATE)) {
+        loans.emplace_back(t.bookId, t.copy, string(t.memberName), t.issueDate, t.returnDate);
+    }
+    sort(loans.begin(), loans.end());
+    return loans;
+}
+
+static bool segmentExists(const string &dir, const string &name) {
+    return filesystem::exists(dir + "/archive/" + name);
+}
+
+// Loans read back the same from the archive as from the live history,
+// after a restart too, with one segment per return month
+static void archivedLoansRoundTrip() {
+    string dir = scratchDir("archive_round_trip");
+    vector<Loan> before;
+    {
+        Library lib(true, 1000, dir);
+        CHECK(lib.addMember("ann", "pw", "member").ok());
+        CHECK(lib.addMember("bob", "pw", "member").ok());
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 3).ok());
+        CHECK(lib.addBook(2, "Emma", "Jane Austen", 1).ok());
+        CHECK(lib.issueBook(1, "ann", "2020-01-03").ok());
+        CHECK(lib.issueBook(2, "bob", "2020-01-10").ok());
+        CHECK(lib.returnBook(1, "ann", "2020-01-20").ok());
+        CHECK(lib.returnBook(2, "bob", "2020-02-02").ok());
+        CHECK(lib.issueBook(1, "bob", "2020-02-05").ok());
+        CHECK(lib.returnBook(1, "bob", "2020-03-01").ok());
+        CHECK(lib.issueBook(1, "ann", "2020-03-10").ok());
+        before = history(lib);
+        CHECK(before.size() == 4);
+
+        lib.setArchiveHorizon(30);
+        CHECK(lib.archiveClosedLoans() == 3);
+        CHECK(lib.archivedLoanCount() == 3);
+        CHECK(lib.allTransactions().size() == 1);  // the open loan stays live
+        CHECK(lib.archiveSegments().size() == 3);
+        CHECK(history(lib) == before);
+    }
+    CHECK(segmentExists(dir, "loans-2020-01.seg"));
+    CHECK(segmentExists(dir, "loans-2020-02.seg"));
+    CHECK(segmentExists(dir, "loans-2020-03.seg"));
+
+    Library lib(true, 1000, dir);
+    CHECK(lib.warning().empty());
+    CHECK(lib.archivedLoanCount() == 3);
+    CHECK(history(lib) == before);
+}
+
+// A loan returned into a month that is already archived gets a segment of
+// its own; the earlier one is never rewritten
+static void laterReturnsGetNewSegment() {
+    string dir = scratchDir("archive_sequence");
+    Library lib(true, 1000, dir);
+    lib.setArchiveHorizon(30);
+    CHECK(lib.addMember("ann", "pw", "member").ok());
+    CHECK(lib.addBook(1, "Dune", "Frank Herbert", 2).ok());
+    CHECK(lib.issueBook(1, "ann", "2020-01-03").ok());
+    CHECK(lib.issueBook(1, "ann", "2020-01-04").ok());
+    CHECK(lib.returnBook(1, "ann", "2020-01-20").ok());
+    CHECK(lib.archiveClosedLoans() == 1);
+    string first = readFile(dir + "/archive/loans-2020-01.seg");
+    CHECK(lib.returnBook(1, "ann", "2020-01-28").ok());
+    CHECK(lib.archiveClosedLoans() == 1);
+    CHECK(segmentExists(dir, "loans-2020-01.2.seg"));
+    CHECK(readFile(dir + "/archive/loans-2020-01.seg") == first);
+    CHECK(lib.archivedLoanCount() == 2);
+    CHECK(history(lib).size() == 2);
+}
+
+// A damaged segment is skipped with a warning; the others still load
+static void damagedSegmentSkipped() {
+    string dir = scratchDir("archive_damaged");
+    {
+        Library lib(true, 1000, dir);
+        lib.setArchiveHorizon(30);
+        CHECK(lib.addMember("ann", "pw", "member").ok());
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 1).ok());
+        CHECK(lib.issueBook(1, "ann", "2020-01-03").ok());
+        CHECK(lib.returnBook(1, "ann", "2020-01-20").ok());
+        CHECK(lib.issueBook(1, "ann", "2020-02-03").ok());
+        CHECK(lib.returnBook(1, "ann", "2020-02-20").ok());
+        CHECK(lib.archiveClosedLoans() == 2);
+    }
+    string path = dir + "/archive/loans-2020-02.seg";
+    filesystem::resize_file(path, filesystem::file_size(path) - 1);
+    Library lib(true, 1000, dir);
+    CHECK(!lib.warning().empty());
+    CHECK(lib.archivedLoanCount() == 1);
+    CHECK(history(lib).size() == 1);
+}
+
+int main() {
+    archivedLoansRoundTrip();
+    laterReturnsGetNewSegment();
+    damagedSegmentSkipped();
+    return testResult();
+}
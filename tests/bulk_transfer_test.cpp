@@ -0,0 +1,125 @@
+// Bulk CSV / JSON Lines export and import
+#include "library_core.h"
+#include "test_util.h"
+
+using namespace std;
+
+static bool hasProblem(const TransferResult &r, const string &problem) {
+    return find(r.problems.begin(), r.problems.end(), problem) != r.problems.end();
+}
+
+static void fillLibrary(Library &lib) {
+    CHECK(lib.addMember("ann", "pw", "member").ok());
+    CHECK(lib.addMember("bob", "secret, \"quoted\"", "librarian").ok());
+    CHECK(lib.addBook(1, "Dune", "Frank Herbert", 2, "Stacks").ok());
+    CHECK(lib.addBook(2, "Pride, Prejudice", "Jane \"J\" Austen", 1).ok());
+    CHECK(lib.issueBook(1, "ann", "2024-01-05").ok());
+    CHECK(lib.returnBook(1, "ann", "2024-01-19").ok());
+    CHECK(lib.issueBook(2, "bob", "2024-02-01").ok());
+    CHECK(lib.issueBook(1, "bob", "2024-02-03").ok());
+}
+
+// Export, import into an empty library and export again: the files match
+static void roundTrip(BulkFormat format, const string &ext) {
+    string dir = scratchDir("transfer_round_trip" + ext);
+    filesystem::create_directories(dir + "/source");
+    filesystem::create_directories(dir + "/copy");
+    Library source(true, 1000, dir + "/source");
+    fillLibrary(source);
+    CHECK(source.exportTo(dir + "/first", format).ok());
+
+    Library copy(true, 1000, dir + "/copy");
+    TransferResult imported = copy.importFrom(dir + "/first");
+    CHECK(imported.ok());
+    CHECK(imported.problems.empty());
+    CHECK(copy.allBooks().size() == 2);
+    CHECK(copy.allTransactions().size() == 3);
+    CHECK(copy.exportTo(dir + "/second", format).ok());
+    for (string table : {"books", "members", "transactions"}) {
+        CHECK(!readFile(dir + "/first/" + table + ext).empty());
+        CHECK(readFile(dir + "/first/" + table + ext) == readFile(dir + "/second/" + table + ext));
+    }
+}
+
+// Every malformed row is reported as file:line and nothing is imported
+static void malformedRowsRejected() {
+    string dir = scratchDir("transfer_rejected");
+    writeFile(dir + "/books.csv",
+              "id,title,author,copies\n"
+              "1,Dune,Frank Herbert,1\n"
+              "1,Emma,Jane Austen,1\n"
+              "x,Emma,Jane Austen,1\n"
+              "3,Emma,Jane Austen,0\n");
+    writeFile(dir + "/members.csv",
+              "name,password,role\n"
+              "ann,pw,member\n"
+              "bob,pw,wizard\n"
+              "ANN,pw,member\n");
+    writeFile(dir + "/transactions.csv",
+              "bookId,member,issueDate,returnDate\n"
+              "1,ann,2024-01-05,2024-01-02\n"
+              "1,carl,2024-01-05,\n"
+              "9,ann,2024-01-05,\n"
+              "1,ann,2024-1-05,\n"
+              "1,ann,2024-01-05,someday\n"
+              "1,ann,2024-01-05,2024-01-05\n");
+    filesystem::create_directories(dir + "/data");
+    Library lib(true, 1000, dir + "/data");
+    TransferResult r = lib.importFrom(dir);
+    CHECK(!r.ok());
+    CHECK(hasProblem(r, "books.csv:3: duplicate book id 1"));
+    CHECK(hasProblem(r, "books.csv:4: book id must be a number"));
+    CHECK(hasProblem(r, "books.csv:5: copies must be at least 1"));
+    CHECK(hasProblem(r, "members.csv:3: invalid role 'wizard'"));
+    CHECK(hasProblem(r, "members.csv:4: duplicate member 'ANN'"));
+    CHECK(hasProblem(r, "transactions.csv:2: return date is before the issue date"));
+    CHECK(hasProblem(r, "transactions.csv:3: unknown member 'carl'"));
+    CHECK(hasProblem(r, "transactions.csv:4: unknown book id 9"));
+    CHECK(hasProblem(r, "transactions.csv:5: issue date must be YYYY-MM-DD"));
+    CHECK(hasProblem(r, "transactions.csv:6: return date must be YYYY-MM-DD or empty"));
+    CHECK(r.problems.size() == 10);  // a same-day return is fine
+    CHECK(lib.allBooks().empty());
+    CHECK(lib.allMembers().empty());
+    CHECK(lib.allTransactions().empty());
+}
+
+// More open loans than copies, or an available count that disagrees with
+// the open loans, is caught once all the loans have been read
+static void inconsistentCountsRejected() {
+    string dir = scratchDir("transfer_counts");
+    writeFile(dir + "/books.jsonl",
+              "{\"id\":1,\"title\":\"Dune\",\"author\":\"Frank Herbert\",\"copies\":1}\n"
+              "{\"id\":2,\"title\":\"Emma\",\"author\":\"Jane Austen\",\"copies\":2,\"available\":2}\n");
+    writeFile(dir + "/members.jsonl", "{\"name\":\"ann\",\"password\":\"pw\",\"role\":\"member\"}\n");
+    writeFile(dir + "/transactions.jsonl",
+              "{\"bookId\":1,\"member\":\"ann\",\"issueDate\":\"2024-01-05\",\"returnDate\":\"\"}\n"
+              "{\"bookId\":1,\"member\":\"ann\",\"issueDate\":\"2024-01-06\",\"returnDate\":\"\"}\n"
+              "{\"bookId\":2,\"member\":\"ann\",\"issueDate\":\"2024-01-06\",\"returnDate\":\"\"}\n");
+    filesystem::create_directories(dir + "/data");
+    Library lib(true, 1000, dir + "/data");
+    TransferResult r = lib.importFrom(dir);
+    CHECK(!r.ok());
+    CHECK(r.problems.size() == 2);
+    CHECK(lib.allBooks().empty());
+}
+
+// Imports only go into an empty library
+static void nonEmptyLibraryRefused() {
+    string dir = scratchDir("transfer_non_empty");
+    filesystem::create_directories(dir + "/source");
+    Library source(true, 1000, dir + "/source");
+    fillLibrary(source);
+    CHECK(source.exportTo(dir + "/export", BulkFormat::CSV).ok());
+    TransferResult r = source.importFrom(dir + "/export");
+    CHECK(r.error == LibraryError::INVALID_INPUT);
+    CHECK(source.allBooks().size() == 2);
+}
+
+int main() {
+    roundTrip(BulkFormat::CSV, ".csv");
+    roundTrip(BulkFormat::JSON_LINES, ".jsonl");
+    malformedRowsRejected();
+    inconsistentCountsRejected();
+    nonEmptyLibraryRefused();
+    return testResult();
+}
@@ -0,0 +1,101 @@
+// Journal replay and commit recovery after interrupted saves
+#include "library_core.h"
+#include "test_util.h"
+
+using namespace std;
+
+// A record cut off mid-append is dropped; the records before it replay
+static void tornJournalTail() {
+    string dir = scratchDir("torn_journal");
+    {
+        Library lib(true, 1000, dir);
+        CHECK(lib.addMember("ann", "pw", "member").ok());
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 2).ok());
+        CHECK(lib.issueBook(1, "ann", "2024-01-05").ok());
+    }
+    writeFile(dir + "/journal.log", "ADD_BOOK\t2\tEmma", true);
+    Library lib(true, 1000, dir);
+    CHECK(lib.getMember("ann") != nullptr);
+    CHECK(lib.getBook(1) != nullptr);
+    CHECK(lib.getBook(2) == nullptr);
+    CHECK(lib.allTransactions().size() == 1);
+    // the torn tail is folded away by a compaction at startup
+    CHECK(readFile(dir + "/journal.log").empty());
+}
+
+// Shadows covered by a manifest are a finished commit: they are installed
+// and the journal, already contained in them, is emptied
+static void manifestRollsForward() {
+    string dir = scratchDir("roll_forward");
+    string before;
+    {
+        Library lib(true, 1000, dir);
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 1).ok());
+        CHECK(lib.compact());
+        before = readFile(dir + "/books.txt");
+        CHECK(lib.addBook(2, "Emma", "Jane Austen", 1).ok());
+        CHECK(lib.compact());
+    }
+    // as if the process died between writing the manifest and the renames
+    filesystem::rename(dir + "/books.txt", dir + "/books.txt.new");
+    writeFile(dir + "/books.txt", before);
+    writeFile(dir + "/commit.manifest", "books.txt\n");
+    writeFile(dir + "/journal.log", "ADD_BOOK\t3\tEmma\tJane Austen\t1\n");
+    Library lib(true, 1000, dir);
+    CHECK(lib.getBook(2) != nullptr);
+    CHECK(lib.getBook(3) == nullptr);
+    CHECK(!filesystem::exists(dir + "/books.txt.new"));
+    CHECK(!filesystem::exists(dir + "/commit.manifest"));
+    CHECK(readFile(dir + "/journal.log").empty());
+}
+
+// Shadows without a manifest never committed and are discarded
+static void uncommittedShadowsDiscarded() {
+    string dir = scratchDir("discard");
+    {
+        Library lib(true, 1000, dir);
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 1).ok());
+        CHECK(lib.compact());
+    }
+    writeFile(dir + "/books.txt.new", "2\nhalf written");
+    Library lib(true, 1000, dir);
+    CHECK(lib.getBook(1) != nullptr);
+    CHECK(lib.getBook(2) == nullptr);
+    CHECK(!filesystem::exists(dir + "/books.txt.new"));
+}
+
+// A commit whose files cannot all be renamed into place keeps its manifest
+// and the journal, refuses further saves, and is finished on the next start
+static void failedInstallRecovered() {
+    string dir = scratchDir("failed_install");
+    {
+        Library lib(true, 1000, dir);
+        CHECK(lib.addMember("ann", "pw", "member").ok());
+        CHECK(lib.addBook(1, "Dune", "Frank Herbert", 2).ok());
+        CHECK(lib.compact());
+        CHECK(lib.issueBook(1, "ann", "2024-01-05").ok());
+        // a directory in its place makes the rename of transactions.txt fail
+        filesystem::remove(dir + "/transactions.txt");
+        filesystem::create_directories(dir + "/transactions.txt/blocker");
+        CHECK(!lib.compact());
+        CHECK(filesystem::exists(dir + "/commit.manifest"));
+        CHECK(filesystem::exists(dir + "/transactions.txt.new"));
+        CHECK(!readFile(dir + "/journal.log").empty());
+        CHECK(lib.addBook(2, "Emma", "Jane Austen", 1).error == LibraryError::SAVE_FAILED);
+    }
+    filesystem::remove_all(dir + "/transactions.txt");
+    Library lib(true, 1000, dir);
+    CHECK(lib.allTransactions().size() == 1);
+    CHECK(lib.getBook(2) == nullptr);
+    CHECK(!filesystem::exists(dir + "/commit.manifest"));
+    CHECK(!filesystem::exists(dir + "/transactions.txt.new"));
+    CHECK(readFile(dir + "/journal.log").empty());
+}
+
+int main() {
+    tornJournalTail();
+    manifestRollsForward();
+    uncommittedShadowsDiscarded();
+    failedInstallRecovered();
+    return testResult();
+}
@@ -0,0 +1,48 @@
+#ifndef LIBRARY_TEST_UTIL_H
+#define LIBRARY_TEST_UTIL_H
+
+// Minimal checks for the test programs: CHECK() reports a failed condition
+// and carries on, and main returns testResult() once every case has run.
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+inline int& failedChecks() {
+    static int failed = 0;
+    return failed;
+}
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n"; \
+            ++failedChecks();                                                         \
+        }                                                                             \
+    } while (0)
+
+inline int testResult() {
+    if (failedChecks()) std::cerr << failedChecks() << " check(s) failed\n";
+    return failedChecks() ? 1 : 0;
+}
+
+// Empty directory of its own under the system temp directory
+inline std::string scratchDir(const std::string &name) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("library_test_" + name);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir.string();
+}
+
+inline std::string readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+inline void writeFile(const std::string &path, const std::string &text, bool append = false) {
+    std::ofstream(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc)) << text;
+}
+
+#endif